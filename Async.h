@@ -0,0 +1,692 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux__) and not defined(SERIALIZER_NO_IO_URING) and __has_include(<linux/io_uring.h>)
+#define SERIALIZER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace serializer {
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+template<typename T>
+struct TaskResult {
+	std::optional<T> value;
+	void return_value(T _value) {
+		value.emplace(std::move(_value));
+	}
+	T take() {
+		return std::move(*value);
+	}
+};
+
+template<>
+struct TaskResult<void> {
+	void return_void() {}
+	void take() {}
+};
+
+template<typename T>
+struct TaskPromise : TaskResult<T> {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+	// set by whichever comes second of the task finishing and the awaiting coroutine suspending, a task that
+	// finishes before lets the awaiting coroutine continue without a nested resume, so that loops over tasks which
+	// complete right away do not grow the stack
+	std::atomic<bool> handOver{false};
+
+	Task<T> get_return_object() noexcept;
+
+	std::suspend_always initial_suspend() noexcept {
+		return {};
+	}
+
+	auto final_suspend() noexcept {
+		struct Awaiter {
+			bool await_ready() noexcept {
+				return false;
+			}
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<TaskPromise> handle) noexcept {
+				auto& promise = handle.promise();
+				if (promise.handOver.exchange(true, std::memory_order_acq_rel)) {
+					return promise.continuation;
+				}
+				return std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		return Awaiter{};
+	}
+
+	void unhandled_exception() noexcept {
+		error = std::current_exception();
+	}
+};
+
+}
+
+// A lazily started coroutine, it runs when it is awaited and hands its result or exception to the awaiting coroutine.
+template<typename T>
+class Task {
+public:
+	using promise_type = detail::TaskPromise<T>;
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+public:
+	explicit Task(std::coroutine_handle<promise_type> _handle) : handle{_handle} {}
+	Task(Task&& other) noexcept : handle{std::exchange(other.handle, {})} {}
+	Task(Task const&) = delete;
+	Task& operator=(Task other) noexcept {
+		std::swap(handle, other.handle);
+		return *this;
+	}
+	~Task() {
+		if (handle) {
+			handle.destroy();
+		}
+	}
+
+	auto operator co_await() && noexcept {
+		struct Awaiter {
+			std::coroutine_handle<promise_type> handle;
+			bool await_ready() noexcept {
+				return false;
+			}
+			bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+				handle.promise().continuation = awaiting;
+				handle.resume();
+				return not handle.promise().handOver.exchange(true, std::memory_order_acq_rel);
+			}
+			T await_resume() {
+				auto& promise = handle.promise();
+				if (promise.error) {
+					std::rethrow_exception(promise.error);
+				}
+				return promise.take();
+			}
+		};
+		return Awaiter{handle};
+	}
+};
+
+template<typename T>
+Task<T> detail::TaskPromise<T>::get_return_object() noexcept {
+	return Task<T>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+}
+
+class IoContext;
+
+namespace detail {
+
+template<typename T>
+struct JobState {
+	std::mutex mutex;
+	std::condition_variable finished;
+	bool done{false};
+	std::coroutine_handle<> waiter;
+	std::exception_ptr error;
+	TaskResult<T> result;
+};
+
+// a coroutine nobody waits for, its frame is freed when it returns
+struct Detached {
+	struct promise_type {
+		Detached get_return_object() noexcept {
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept {
+			std::terminate();
+		}
+	};
+};
+
+}
+
+// A task started on an IoContext, it runs on its own and is either awaited by a coroutine or waited for with get().
+template<typename T = void>
+class Job {
+	std::shared_ptr<detail::JobState<T>> state;
+
+	T result() {
+		if (state->error) {
+			std::rethrow_exception(state->error);
+		}
+		return state->result.take();
+	}
+
+public:
+	explicit Job(std::shared_ptr<detail::JobState<T>> _state) : state{std::move(_state)} {}
+
+	bool await_ready() {
+		std::lock_guard lock{state->mutex};
+		return state->done;
+	}
+	bool await_suspend(std::coroutine_handle<> awaiting) {
+		std::lock_guard lock{state->mutex};
+		if (state->done) {
+			return false;
+		}
+		state->waiter = awaiting;
+		return true;
+	}
+	T await_resume() {
+		return result();
+	}
+
+	// blocks the calling thread, which must not be one of the threads of the IoContext
+	T get() {
+		{
+			std::unique_lock lock{state->mutex};
+			state->finished.wait(lock, [&] { return state->done; });
+		}
+		return result();
+	}
+};
+
+enum class IoBackend {
+	Automatic, // io_uring if the kernel offers it, poll otherwise
+	IoUring,
+	Poll,      // nonblocking read and write, waiting for readiness with poll
+};
+
+namespace detail {
+
+#ifdef SERIALIZER_IO_URING
+// the rings of io_uring mapped into this process, set up with raw system calls so that liburing is not needed
+class Uring {
+	int fd{-1};
+	void* ring{MAP_FAILED};
+	std::size_t ringSize{0};
+	io_uring_sqe* sqes{static_cast<io_uring_sqe*>(MAP_FAILED)};
+	std::size_t sqesSize{0};
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	io_uring_cqe* cqes;
+	// the ring is submitted to from any thread
+	std::mutex submitMutex;
+	// the kernel hands the operations from the submitting to the completing thread, this counter tells
+	// the memory model (and thread sanitizers) that the writes to an operation happened before its completion
+	std::atomic<std::uint64_t> submitted{0};
+
+	static unsigned load(unsigned* p) {
+		return std::atomic_ref<unsigned>{*p}.load(std::memory_order_acquire);
+	}
+	static void store(unsigned* p, unsigned value) {
+		std::atomic_ref<unsigned>{*p}.store(value, std::memory_order_release);
+	}
+
+public:
+	Uring() = default;
+	Uring(Uring const&) = delete;
+	~Uring() {
+		if (sqes != MAP_FAILED) {
+			munmap(sqes, sqesSize);
+		}
+		if (ring != MAP_FAILED) {
+			munmap(ring, ringSize);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	// false if the kernel has no io_uring or lacks reads and writes at the current file position
+	bool setup(unsigned entries) {
+		io_uring_params params{};
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (fd < 0) {
+			return false;
+		}
+		if (not (params.features & IORING_FEAT_SINGLE_MMAP) or not (params.features & IORING_FEAT_RW_CUR_POS)) {
+			return false;
+		}
+		ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+		                    params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+		ring = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if (ring == MAP_FAILED or sqes == MAP_FAILED) {
+			return false;
+		}
+		auto at = [&](std::uint32_t offset) { return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset); };
+		sqTail  = at(params.sq_off.tail);
+		sqMask  = at(params.sq_off.ring_mask);
+		sqArray = at(params.sq_off.array);
+		cqHead  = at(params.cq_off.head);
+		cqTail  = at(params.cq_off.tail);
+		cqMask  = at(params.cq_off.ring_mask);
+		cqes    = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(ring) + params.cq_off.cqes);
+		return true;
+	}
+
+	// the kernel takes the entry within io_uring_enter, so the submission ring never holds more than one
+	void submit(std::uint8_t opcode, int ioFd, void* addr, std::uint32_t len, std::uint32_t pollEvents, std::uint64_t userData) {
+		std::lock_guard lock{submitMutex};
+		auto tail  = *sqTail;
+		auto index = tail & *sqMask;
+		auto& sqe  = sqes[index];
+		sqe = io_uring_sqe{};
+		sqe.opcode    = opcode;
+		sqe.fd        = ioFd;
+		sqe.addr      = reinterpret_cast<std::uint64_t>(addr);
+		sqe.len       = len;
+		sqe.off       = ~std::uint64_t{0}; // the current file position
+		sqe.poll_events = static_cast<decltype(sqe.poll_events)>(pollEvents);
+		sqe.user_data = userData;
+		sqArray[index] = index;
+		submitted.fetch_add(1, std::memory_order_release);
+		store(sqTail, tail + 1);
+		while (syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) < 0) {
+			if (errno != EINTR and errno != EAGAIN and errno != EBUSY) {
+				throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+			}
+		}
+	}
+
+	// blocks until at least one operation completed and calls cb with the user data and result of each
+	template<typename Cb>
+	void complete(Cb&& cb) {
+		if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 and errno != EINTR) {
+			throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+		}
+		auto head = *cqHead;
+		auto tail = load(cqTail);
+		submitted.load(std::memory_order_acquire);
+		for (; head != tail; ++head) {
+			auto const& cqe = cqes[head & *cqMask];
+			cb(cqe.user_data, cqe.res);
+		}
+		store(cqHead, head);
+	}
+};
+#endif
+
+}
+
+// Runs coroutines on a small pool of threads and waits for their reads and writes on file descriptors, with
+// io_uring where the kernel offers it and with nonblocking read and write and poll otherwise. A dedicated
+// thread waits for the I/O, coroutines are always resumed on the pool. Everything started on the context
+// has to be finished before it is destroyed.
+class IoContext {
+	struct Waiter {
+		int fd;
+		short events;
+		std::coroutine_handle<> handle;
+	};
+
+#ifdef SERIALIZER_IO_URING
+	// an io_uring operation, the kernel hands its address back on completion
+	struct Operation {
+		IoContext& context;
+		std::uint8_t opcode;
+		int fd;
+		void* addr;
+		std::uint32_t len;
+		std::uint32_t pollEvents;
+		int result{0};
+		std::coroutine_handle<> handle;
+
+		bool await_ready() noexcept {
+			return false;
+		}
+		void await_suspend(std::coroutine_handle<> _handle);
+		int await_resume() noexcept {
+			return result;
+		}
+	};
+#endif
+
+	IoBackend backend;
+	std::mutex mutex;
+	std::condition_variable wakeWorkers;
+	std::deque<std::coroutine_handle<>> ready;
+	bool stopping{false};
+	// fds waited for with poll and a pipe that interrupts poll when one is added
+	std::vector<Waiter> waiters;
+	int wakePipe[2]{-1, -1};
+#ifdef SERIALIZER_IO_URING
+	std::unique_ptr<detail::Uring> uring;
+#endif
+	std::vector<std::thread> workers;
+	std::thread reactor;
+
+	void work() {
+		while (true) {
+			std::coroutine_handle<> handle;
+			{
+				std::unique_lock lock{mutex};
+				wakeWorkers.wait(lock, [&] { return stopping or not ready.empty(); });
+				if (ready.empty()) {
+					return;
+				}
+				handle = ready.front();
+				ready.pop_front();
+			}
+			handle.resume();
+		}
+	}
+
+	void pollLoop() {
+		std::vector<Waiter> polled;
+		std::vector<pollfd> fds;
+		while (true) {
+			{
+				std::lock_guard lock{mutex};
+				if (stopping) {
+					return;
+				}
+				polled.insert(polled.end(), waiters.begin(), waiters.end());
+				waiters.clear();
+			}
+			fds.assign(1, pollfd{wakePipe[0], POLLIN, 0});
+			for (auto const& waiter : polled) {
+				fds.push_back(pollfd{waiter.fd, waiter.events, 0});
+			}
+			if (::poll(fds.data(), fds.size(), -1) < 0) {
+				continue;
+			}
+			if (fds[0].revents) {
+				char drain[64];
+				while (::read(wakePipe[0], drain, sizeof(drain)) > 0) {}
+			}
+			// errors and hang ups wake the waiter too, its next read or write reports them
+			std::size_t kept{0};
+			for (std::size_t i{0}; i < polled.size(); ++i) {
+				if (fds[i + 1].revents) {
+					post(polled[i].handle);
+				} else {
+					polled[kept++] = polled[i];
+				}
+			}
+			polled.resize(kept);
+		}
+	}
+
+#ifdef SERIALIZER_IO_URING
+	void uringLoop() {
+		bool stop{false};
+		while (not stop) {
+			uring->complete([&](std::uint64_t userData, int result) {
+				if (userData == 0) {
+					stop = true;
+					return;
+				}
+				auto* operation = reinterpret_cast<Operation*>(userData);
+				operation->result = result;
+				post(operation->handle);
+			});
+		}
+	}
+#endif
+
+	void wait(int fd, short events, std::coroutine_handle<> handle) {
+		{
+			std::lock_guard lock{mutex};
+			waiters.push_back(Waiter{fd, events, handle});
+		}
+		char wake{0};
+		[[maybe_unused]] auto written = ::write(wakePipe[1], &wake, 1);
+	}
+
+	auto readiness(int fd, short events) {
+		struct Awaiter {
+			IoContext& context;
+			int fd;
+			short events;
+			bool await_ready() noexcept {
+				return false;
+			}
+			void await_suspend(std::coroutine_handle<> handle) {
+				context.wait(fd, events, handle);
+			}
+			void await_resume() noexcept {}
+		};
+		return Awaiter{*this, fd, events};
+	}
+
+#ifdef SERIALIZER_IO_URING
+	// reads or writes with io_uring, waiting for readiness on nonblocking fds
+	Task<std::size_t> transfer(std::uint8_t opcode, int fd, void* data, std::size_t size, short events, char const* what) {
+		auto len = static_cast<std::uint32_t>(std::min<std::size_t>(size, std::size_t{1} << 30));
+		while (true) {
+			auto result = co_await Operation{*this, opcode, fd, data, len, 0, 0, {}};
+			if (result >= 0) {
+				co_return static_cast<std::size_t>(result);
+			}
+			if (result == -EAGAIN) {
+				co_await Operation{*this, IORING_OP_POLL_ADD, fd, nullptr, 0, static_cast<std::uint32_t>(events), 0, {}};
+			} else if (result != -EINTR) {
+				throw std::system_error(-result, std::generic_category(), what);
+			}
+		}
+	}
+#endif
+
+public:
+	explicit IoContext(std::size_t threads = 1, IoBackend _backend = IoBackend::Automatic)
+		: backend{_backend}
+	{
+		if (threads == 0) {
+			throw std::invalid_argument("an IoContext needs at least one thread");
+		}
+#ifdef SERIALIZER_IO_URING
+		if (backend != IoBackend::Poll) {
+			uring = std::make_unique<detail::Uring>();
+			if (uring->setup(256)) {
+				backend = IoBackend::IoUring;
+			} else if (backend == IoBackend::IoUring) {
+				throw std::runtime_error("io_uring is not available");
+			} else {
+				uring.reset();
+				backend = IoBackend::Poll;
+			}
+		}
+#else
+		if (backend == IoBackend::IoUring) {
+			throw std::runtime_error("io_uring is not available");
+		}
+		backend = IoBackend::Poll;
+#endif
+		if (backend == IoBackend::Poll) {
+			if (::pipe(wakePipe) < 0) {
+				throw std::system_error(errno, std::generic_category(), "pipe");
+			}
+			fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL) | O_NONBLOCK);
+			fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL) | O_NONBLOCK);
+			reactor = std::thread([this] { pollLoop(); });
+		}
+#ifdef SERIALIZER_IO_URING
+		else {
+			reactor = std::thread([this] { uringLoop(); });
+		}
+#endif
+		for (std::size_t i{0}; i < threads; ++i) {
+			workers.emplace_back([this] { work(); });
+		}
+	}
+
+	IoContext(IoContext const&) = delete;
+
+	~IoContext() {
+		{
+			std::lock_guard lock{mutex};
+			stopping = true;
+		}
+		wakeWorkers.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+#ifdef SERIALIZER_IO_URING
+		if (uring) {
+			uring->submit(IORING_OP_NOP, -1, nullptr, 0, 0, 0);
+		}
+#endif
+		if (wakePipe[1] >= 0) {
+			char wake{0};
+			[[maybe_unused]] auto written = ::write(wakePipe[1], &wake, 1);
+		}
+		reactor.join();
+		for (auto fd : wakePipe) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+	}
+
+	IoBackend getBackend() const {
+		return backend;
+	}
+
+	// resumes the coroutine on one of the threads
+	void post(std::coroutine_handle<> handle) {
+		{
+			std::lock_guard lock{mutex};
+			ready.push_back(handle);
+		}
+		wakeWorkers.notify_one();
+	}
+
+	// continues the awaiting coroutine on one of the threads
+	auto schedule() {
+		struct Awaiter {
+			IoContext& context;
+			bool await_ready() noexcept {
+				return false;
+			}
+			void await_suspend(std::coroutine_handle<> handle) {
+				context.post(handle);
+			}
+			void await_resume() noexcept {}
+		};
+		return Awaiter{*this};
+	}
+
+	// runs the task on the context, concurrently to the caller
+	template<typename T>
+	Job<T> start(Task<T> task) {
+		auto state = std::make_shared<detail::JobState<T>>();
+		[](IoContext& context, Task<T> task, std::shared_ptr<detail::JobState<T>> state) -> detail::Detached {
+			co_await context.schedule();
+			try {
+				if constexpr (std::is_void_v<T>) {
+					co_await std::move(task);
+				} else {
+					state->result.return_value(co_await std::move(task));
+				}
+			} catch (...) {
+				state->error = std::current_exception();
+			}
+			std::coroutine_handle<> waiter;
+			{
+				std::lock_guard lock{state->mutex};
+				state->done = true;
+				waiter = std::exchange(state->waiter, {});
+			}
+			state->finished.notify_all();
+			if (waiter) {
+				context.post(waiter);
+			}
+		}(*this, std::move(task), state);
+		return Job<T>{std::move(state)};
+	}
+
+	// prepares a file descriptor for read() and write(), the poll backend needs it to be nonblocking
+	void attach(int fd) {
+		if (backend == IoBackend::Poll) {
+			auto flags = fcntl(fd, F_GETFL);
+			if (flags < 0 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+				throw std::system_error(errno, std::generic_category(), "fcntl");
+			}
+		}
+	}
+
+	// reads up to size bytes at the current position of fd, 0 at its end
+	Task<std::size_t> read(int fd, std::byte* data, std::size_t size) {
+#ifdef SERIALIZER_IO_URING
+		if (backend == IoBackend::IoUring) {
+			co_return co_await transfer(IORING_OP_READ, fd, data, size, POLLIN, "read");
+		}
+#endif
+		while (true) {
+			auto result = ::read(fd, data, size);
+			if (result >= 0) {
+				co_return static_cast<std::size_t>(result);
+			}
+			if (errno == EAGAIN or errno == EWOULDBLOCK) {
+				co_await readiness(fd, POLLIN);
+			} else if (errno != EINTR) {
+				throw std::system_error(errno, std::generic_category(), "read");
+			}
+		}
+	}
+
+	// writes up to size bytes at the current position of fd
+	Task<std::size_t> write(int fd, std::byte const* data, std::size_t size) {
+#ifdef SERIALIZER_IO_URING
+		if (backend == IoBackend::IoUring) {
+			co_return co_await transfer(IORING_OP_WRITE, fd, const_cast<std::byte*>(data), size, POLLOUT, "write");
+		}
+#endif
+		while (true) {
+			auto result = ::write(fd, data, size);
+			if (result >= 0) {
+				co_return static_cast<std::size_t>(result);
+			}
+			if (errno == EAGAIN or errno == EWOULDBLOCK) {
+				co_await readiness(fd, POLLOUT);
+			} else if (errno != EINTR) {
+				throw std::system_error(errno, std::generic_category(), "write");
+			}
+		}
+	}
+};
+
+#ifdef SERIALIZER_IO_URING
+inline void IoContext::Operation::await_suspend(std::coroutine_handle<> _handle) {
+	handle = _handle;
+	context.uring->submit(opcode, fd, addr, len, pollEvents, reinterpret_cast<std::uint64_t>(this));
+}
+#endif
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Converter.h"
+
+namespace serializer {
+
+namespace detail {
+
+// the last encoding of a cached value, format tells the settings of the backend it was written with
+struct EncodingCache {
+	std::vector<std::byte> bytes;
+	std::uint64_t format{0};
+	// the backend type that wrote the bytes, the address of a static of it
+	void const* writer{nullptr};
+	// the bytes are child elements
+	bool nested{false};
+	// the ends of the blocks the checksums of the backend cover and the header length of children with checksums
+	std::vector<std::pair<std::size_t, std::size_t>> blocks;
+	bool valid{false};
+};
+
+}
+
+// Holds a value together with its last encoding, so that backends which support it (ebml) copy the
+// bytes of an unchanged value instead of serializing it again. It is used as a field:
+//     serializer::Cached<Config> config;
+//     serializer["config"] % config;
+// The value is read through get() and changed through modify(), which drops the encoding. Changes
+// to values that contain Cached fields themselves have to go through modify() of every enclosing
+// Cached. Deserializing drops the encoding, other backends write the value as usual.
+template<typename T>
+class Cached {
+	T value;
+	detail::EncodingCache cache;
+
+	template<typename, typename>
+	friend class Converter;
+
+public:
+	using value_type = T;
+
+	Cached() = default;
+	Cached(T _value) : value{std::move(_value)} {}
+
+	T const& get() const {
+		return value;
+	}
+
+	T const& operator*() const {
+		return value;
+	}
+
+	T const* operator->() const {
+		return &value;
+	}
+
+	// the value for changes, the next serialization encodes it again
+	T& modify() {
+		cache.valid = false;
+		return value;
+	}
+
+	bool isDirty() const {
+		return not cache.valid;
+	}
+
+	// for backends that keep the encoding
+	detail::EncodingCache& encodingCache() {
+		return cache;
+	}
+};
+
+namespace traits {
+
+template <typename T>
+struct is_cached : std::false_type {};
+template <typename T>
+struct is_cached<Cached<T>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_cached_v = is_cached<T>::value;
+
+}
+
+template<typename T>
+struct Converter<Cached<T>> {
+	using value_type = Cached<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.value;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		x.cache.valid = false;
+		adapter % x.value;
+	}
+};
+
+}
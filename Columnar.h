@@ -0,0 +1,51 @@
+#pragma once
+
+#include <type_traits>
+
+#include "Converter.h"
+
+namespace serializer {
+
+// Wraps a std::vector of records so that backends which support it (ebml) write it column by column:
+//     serializer["samples"] % serializer::columnar(samples);
+// The values of every field of all records are gathered into one column, integer columns are packed
+// like packed() sequences and string columns keep every distinct string once. The serialize
+// functions of the records may only write scalars, enums and strings, and have to write the same
+// fields in the same order for every record. Other backends write the vector as usual.
+template<typename Container>
+struct Columnar {
+	using container_type = Container;
+	static_assert(std::is_class_v<typename Container::value_type>, "only containers of records can be columnar");
+	Container& container;
+};
+
+template<typename Container>
+Columnar<Container> columnar(Container& container) {
+	return {container};
+}
+
+namespace traits {
+
+template <typename T>
+struct is_columnar : std::false_type {};
+template <typename Container>
+struct is_columnar<Columnar<Container>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_columnar_v = is_columnar<T>::value;
+
+}
+
+template<typename Container>
+struct Converter<Columnar<Container>> {
+	using value_type = Columnar<Container>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.container;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		adapter % x.container;
+	}
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Converter.h"
+
+namespace serializer {
+
+enum class Codec : std::uint8_t {
+	None    = 0,
+	LZ      = 1, // built-in LZ77 codec, fast and without dependencies
+	Deflate = 2, // zlib, needs SERIALIZER_USE_ZLIB to be defined and linking against libz
+};
+
+// Wraps a value so that backends which support it (ebml) write its whole subtree compressed:
+//     serializer["snapshot"] % serializer::compressed(snapshot, serializer::Codec::LZ);
+// The encoded subtree is cut into blocks of blockSize bytes that are compressed independently,
+// so large values can be decompressed in parallel. The ebml Deserializer recognizes compressed
+// elements, they are read with or without compressed(). Other backends write the value as usual.
+template<typename T>
+struct Compressed {
+	using value_type = T;
+	T& value;
+	Codec codec;
+	std::size_t blockSize;
+};
+
+template<typename T>
+Compressed<T> compressed(T& value, Codec codec = Codec::LZ, std::size_t blockSize = 256*1024) {
+	return {value, codec, blockSize};
+}
+
+namespace traits {
+
+template <typename T>
+struct is_compressed : std::false_type {};
+template <typename T>
+struct is_compressed<Compressed<T>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_compressed_v = is_compressed<T>::value;
+
+}
+
+template<typename T>
+struct Converter<Compressed<T>> {
+	using value_type = Compressed<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.value;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		adapter % x.value;
+	}
+};
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+
+namespace serializer {
+
+// State that lives as long as one document is (de)serialized.
+// The root adapter creates the context and every adapter derived from it shares it, so
+// converters can keep track of things across the whole document (e.g. shared objects).
+struct Context {
+private:
+	std::unordered_map<std::type_index, std::shared_ptr<void>> entries;
+	std::size_t uses{0};
+public:
+	// returns the default constructed entry of type T of this document
+	template<typename T>
+	T& get() {
+		++uses;
+		auto& entry = entries[typeid(T)];
+		if (not entry) {
+			entry = std::make_shared<T>();
+		}
+		return *static_cast<T*>(entry.get());
+	}
+
+	// the number of get() calls so far, an encoding during which it did not change does not depend on
+	// the state of the document
+	std::size_t useCount() const {
+		return uses;
+	}
+};
+
+}
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <map>
 #include <unordered_map>
+#include <optional>
 #include <set>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
+#include <variant>
 #include <vector>
 #include <cstring>
 #include <string>
@@ -18,6 +26,67 @@ class Converter;
 
 namespace detail {
 
+// set while a value wrapped by update() is deserialized, see Update.h
+struct UpdateMode {
+	bool enabled{false};
+};
+
+// every container decode asks for the mode, the backends keep it next to their context and return it from
+// getUpdateMode(), other adapters store it in the context
+template<typename Deserializer>
+UpdateMode& updateMode(Deserializer& adapter) {
+	if constexpr (requires { adapter.getUpdateMode(); }) {
+		return adapter.getUpdateMode();
+	} else {
+		return adapter.getContext().template get<UpdateMode>();
+	}
+}
+
+template<typename Deserializer>
+bool isUpdating(Deserializer& adapter) {
+	return updateMode(adapter).enabled;
+}
+
+// fills a map entry by entry, in update mode the nodes of the previous content are reused:
+// known keys keep their node and value, new keys take over the nodes of vanished ones with a
+// reset value
+template<typename T>
+struct MapInserter {
+	T& x;
+	T previous;
+
+	MapInserter(T& _x, bool update) : x{_x} {
+		if (update) {
+			x.swap(previous);
+		} else {
+			x.clear();
+		}
+	}
+
+	// returns the value to decode into, key is moved from if it had to be stored
+	typename T::mapped_type& operator()(typename T::key_type& key) {
+		if (previous.empty()) {
+			return x.try_emplace(x.end(), std::move(key))->second;
+		}
+		auto node = previous.extract(key);
+		if (not node) {
+			node = previous.extract(previous.begin());
+			node.key()    = std::move(key);
+			node.mapped() = {};
+		}
+		return x.insert(x.end(), std::move(node))->second;
+	}
+};
+
+// passed as CountCB to deserializeSequence, sizes the container before the elements arrive
+template<typename T>
+auto reserveFor(T& x) {
+	return [&x](std::size_t count) {
+		if constexpr (traits::has_reserve_v<T>) {
+			x.reserve(count);
+		}
+	};
+}
 
 template<typename T>
 struct FixedSequenceContainerConverter {
@@ -28,10 +97,16 @@ struct FixedSequenceContainerConverter {
 	}
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, value_type& x) {
-		using inner_type = typename value_type::value_type;
-		x = {};
+		if (not isUpdating(adapter)) {
+			x = {};
+		}
 		std::size_t i{};
-		adapter. template deserializeSequence<inner_type>([&x, &i](inner_type v) { x[i++] = std::move(v); });
+		adapter.deserializeElements([&x, &i](auto& elem) {
+			if (i == std::size(x)) {
+				throw std::runtime_error("sequence has more elements than fit into a fixed size container");
+			}
+			elem % x[i++];
+		});
 	}
 };
 
@@ -40,9 +115,32 @@ struct SequenceContainerConverter : FixedSequenceContainerConverter<T> {
 	using value_type = FixedSequenceContainerConverter<T>::value_type;
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, value_type& x) {
-		x.clear();
 		using inner_type = typename value_type::value_type;
-		adapter. template deserializeSequence<inner_type>([&x](inner_type v) { x.emplace_back(std::move(v)); });
+		// in update mode the existing elements are decoded into and only surplus ones are dropped
+		if (not isUpdating(adapter)) {
+			x.clear();
+		}
+		std::size_t i{};
+		adapter.deserializeElements([&x, &i](auto& elem) {
+			if constexpr (std::is_same_v<decltype(x.back()), inner_type&>) {
+				// decode straight into the element
+				if (i == x.size()) {
+					x.resize(i+1);
+				}
+				elem % x[i];
+			} else {
+				// proxy references (std::vector<bool>) need a temporary
+				inner_type v{};
+				elem % v;
+				if (i == x.size()) {
+					x.push_back(v);
+				} else {
+					x[i] = v;
+				}
+			}
+			++i;
+		}, reserveFor(x));
+		x.erase(x.begin() + i, x.end());
 	}
 };
 
@@ -56,11 +154,101 @@ struct ContainerConverter {
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, value_type& x) {
 		using inner_type = typename value_type::value_type;
-		x.clear();
-		adapter. template deserializeSequence<inner_type>([&x](inner_type v) { x.emplace(std::move(v)); });
+		// in update mode the nodes of the previous content are reused for the new elements
+		value_type previous;
+		if (isUpdating(adapter)) {
+			x.swap(previous);
+		} else {
+			x.clear();
+		}
+		adapter.deserializeElements([&x, &previous](auto& elem) {
+			if (not previous.empty()) {
+				auto node = previous.extract(previous.begin());
+				elem % node.value();
+				x.insert(x.end(), std::move(node));
+				return;
+			}
+			inner_type v;
+			elem % v;
+			x.emplace_hint(x.end(), std::move(v));
+		}, reserveFor(x));
 	}
 };
 
+// switches x to the alternative with the given index, a value of that alternative is kept
+template<typename Variant, std::size_t... I>
+void emplaceAlternative(Variant& x, std::size_t index, std::index_sequence<I...>) {
+	if (index >= sizeof...(I)) {
+		throw std::runtime_error("variant index out of range");
+	}
+	if (x.index() != index) {
+		((index == I ? void(x.template emplace<I>()) : void()), ...);
+	}
+}
+
+// identities of all objects that are referenced through pointers in one document
+struct SharedObjects {
+	std::unordered_map<void const*, std::uint64_t> ids;               // serialization
+	std::unordered_map<std::uint64_t, std::shared_ptr<void>> objects; // deserialization
+};
+
+// writes the id of object (0 for nullptr), returns true if this is its first occurrence
+// and its content has to follow
+template<typename Serializer>
+bool writeObjectId(Serializer& adapter, void const* object) {
+	std::uint64_t id{0};
+	bool first{false};
+	if (object) {
+		auto& ids = adapter.getContext().template get<SharedObjects>().ids;
+		auto [it, inserted] = ids.try_emplace(object, ids.size()+1);
+		id    = it->second;
+		first = inserted;
+	}
+	adapter["id"] % id;
+	return first;
+}
+
+// false if the backend knows that the element is missing, positional backends cannot tell
+template<typename Deserializer>
+bool isPresent(Deserializer&& adapter) {
+	if constexpr (requires { adapter.present(); }) {
+		return adapter.present();
+	} else {
+		return true;
+	}
+}
+
+// the first occurrence of an object that is read carries its content, a document referencing an id
+// before that was written in a different order than it is read
+inline void missingObject(std::uint64_t id) {
+	throw std::runtime_error("shared object " + std::to_string(id) + " is referenced before its content");
+}
+
+// backends that cannot tell an empty container from an absent value mark the node before its elements or entries
+template<typename Serializer>
+void beginSequence(Serializer& adapter) {
+	if constexpr (requires { adapter.beginSequence(); }) {
+		adapter.beginSequence();
+	}
+}
+template<typename Serializer>
+void beginMap(Serializer& adapter, bool stringKeys) {
+	if constexpr (requires { adapter.beginMap(stringKeys); }) {
+		adapter.beginMap(stringKeys);
+	}
+}
+
+// backends that read string keyed maps back sorted by their key (json objects) declare sortedMembers
+template<typename Serializer, typename T>
+constexpr bool writesSortedEntries() {
+	using Key = typename T::key_type;
+	if constexpr (requires { Serializer::sortedMembers; }) {
+		return Serializer::sortedMembers and std::is_same_v<Key, std::string>
+		       and not std::is_same_v<T, std::map<Key, typename T::mapped_type, std::less<Key>, typename T::allocator_type>>;
+	}
+	return false;
+}
+
 }
 
 template<typename T, std::size_t N>
@@ -70,8 +258,10 @@ struct Converter<std::vector<Ts...>>       : detail::SequenceContainerConverter<
 template<typename... Ts>
 struct Converter<std::basic_string<Ts...>> : detail::SequenceContainerConverter<std::basic_string<Ts...>> {};
 
-template<typename T>
-struct Converter<std::set<T>> : detail::ContainerConverter<std::set<T>> {};
+template<typename... Ts>
+struct Converter<std::set<Ts...>> : detail::ContainerConverter<std::set<Ts...>> {};
+template<typename... Ts>
+struct Converter<std::unordered_set<Ts...>> : detail::ContainerConverter<std::unordered_set<Ts...>> {};
 
 template<typename Key, typename Value>
 struct Converter<std::pair<Key, Value>> {
@@ -88,6 +278,94 @@ struct Converter<std::pair<Key, Value>> {
 	}
 };
 
+// an absent value is omitted, it costs nothing as a field and an empty marker as element of a sequence
+template<typename T>
+struct Converter<std::optional<T>> {
+	using value_type = std::optional<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		if (x) {
+			adapter % *x;
+		} else {
+			adapter.omit();
+		}
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		if (not adapter.present()) {
+			x.reset();
+			return;
+		}
+		if (not x) {
+			x.emplace();
+		}
+		adapter % *x;
+	}
+};
+
+// positional elements: the index of the alternative followed by its value
+template<typename... Ts>
+struct Converter<std::variant<Ts...>> {
+	using value_type = std::variant<Ts...>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		if (x.valueless_by_exception()) {
+			throw std::runtime_error("cannot serialize a valueless variant");
+		}
+		auto index = static_cast<std::uint32_t>(x.index());
+		adapter.serializeElement([&](auto& elem) { elem % index; });
+		adapter.serializeElement([&](auto& elem) {
+			std::visit([&](auto& v) { elem % v; }, x);
+		});
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		std::size_t i{0};
+		adapter.deserializeElements([&](auto& elem) {
+			if (i == 0) {
+				std::uint32_t index{0};
+				elem % index;
+				detail::emplaceAlternative(x, index, std::index_sequence_for<Ts...>{});
+			} else if (i == 1) {
+				std::visit([&](auto& v) { elem % v; }, x);
+			}
+			++i;
+		});
+	}
+};
+
+template<>
+struct Converter<std::monostate> {
+	using value_type = std::monostate;
+	template<typename Serializer>
+	void serialize(Serializer&, value_type&) {}
+	template<typename Deserializer>
+	void deserialize(Deserializer&, value_type&) {}
+};
+
+// every member is a positional element
+template<typename... Ts>
+struct Converter<std::tuple<Ts...>> {
+	using value_type = std::tuple<Ts...>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		std::apply([&](auto&... members) {
+			(adapter.serializeElement([&](auto& elem) { elem % members; }), ...);
+		}, x);
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		std::size_t i{0};
+		adapter.deserializeElements([&](auto& elem) {
+			std::size_t j{0};
+			std::apply([&](auto&... members) {
+				((j++ == i ? void(elem % members) : void()), ...);
+			}, x);
+			++i;
+		});
+	}
+};
+
 template<typename T>
 struct Converter<T, typename std::enable_if<std::is_enum<T>::value>::type> {
 	using value_type = typename std::underlying_type<T>::type;
@@ -108,15 +386,86 @@ template<typename T>
 struct Converter<T, typename std::enable_if<traits::is_map_v<T>>::type> {
 	template<typename Serializer>
 	void serialize(Serializer& adapter, T& x) {
-		adapter.serializeSequence(begin(x), end(x));
+		detail::beginMap(adapter, std::is_same_v<typename T::key_type, std::string>);
+		auto entry = [&](auto& key, auto& value) {
+			adapter.serializeEntry([&](auto& k) { k % key; }, [&](auto& v) { v % value; });
+		};
+		if constexpr (detail::writesSortedEntries<Serializer, T>()) {
+			// written in the order they are read, so that shared objects come before their references
+			std::vector<typename T::value_type*> sorted;
+			sorted.reserve(x.size());
+			for (auto& e : x) {
+				sorted.push_back(&e);
+			}
+			std::sort(sorted.begin(), sorted.end(), [](auto const* a, auto const* b) { return a->first < b->first; });
+			for (auto* e : sorted) {
+				entry(e->first, e->second);
+			}
+		} else {
+			for (auto& [key, value] : x) {
+				entry(key, value);
+			}
+		}
 	}
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, T& x) {
-		using value_type = std::pair<typename T::key_type, typename T::mapped_type>;
-		x.clear();
-		adapter. template deserializeSequence<value_type>([&x](value_type v) {
-			x[std::move(v.first)] = std::move(v.second);
-		});
+		detail::MapInserter<T> inserter{x, detail::isUpdating(adapter)};
+		// the key is needed before the node exists, the value is decoded into the node
+		typename T::key_type key;
+		adapter.deserializeEntries([&](auto& k, auto& v) {
+			k % key;
+			v % inserter(key);
+		}, detail::reserveFor(x));
+	}
+};
+
+// shared objects are written once, every further reference to them only carries their id
+template<typename T>
+struct Converter<std::shared_ptr<T>, typename std::enable_if<not std::is_polymorphic_v<T>>::type> {
+	using value_type = std::shared_ptr<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		if (detail::writeObjectId(adapter, x.get())) {
+			adapter["content"] % *x;
+		}
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		std::uint64_t id{0};
+		adapter["id"] % id;
+		if (id == 0) {
+			x.reset();
+			return;
+		}
+		auto& objects = adapter.getContext().template get<detail::SharedObjects>().objects;
+		if (auto it = objects.find(id); it != objects.end()) {
+			x = std::static_pointer_cast<T>(it->second);
+			return;
+		}
+		auto&& content = adapter["content"];
+		if (not detail::isPresent(content)) {
+			detail::missingObject(id);
+		}
+		// the object is known before its content is read, so cycles resolve to it
+		x = std::make_shared<T>();
+		objects.emplace(id, x);
+		content % *x;
+	}
+};
+
+template<typename T>
+struct Converter<std::weak_ptr<T>> {
+	using value_type = std::weak_ptr<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		auto shared = x.lock();
+		Converter<std::shared_ptr<T>>{}.serialize(adapter, shared);
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		std::shared_ptr<T> shared;
+		Converter<std::shared_ptr<T>>{}.deserialize(adapter, shared);
+		x = shared;
 	}
 };
 
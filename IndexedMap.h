@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Converter.h"
+
+namespace serializer {
+
+// Wraps a std::map or std::unordered_map so that backends which support it (ebml) write its
+// entries in key order behind an index of their offsets:
+//     serializer["table"] % serializer::indexed(table);
+// A single entry can then be found by binary search without decoding the others:
+//     std::string value;
+//     bool found = deserializer["table"].lookup(key, value);
+// The order is the one of std::less on the key type, unordered maps are sorted when written.
+// The whole map is read as usual, also into a map that is not wrapped. Other backends write the
+// map as usual.
+template<typename Map>
+struct IndexedMap {
+	using map_type = Map;
+	static_assert(traits::is_map_v<Map>, "only maps can be indexed");
+	Map& map;
+};
+
+template<typename Map>
+IndexedMap<Map> indexed(Map& map) {
+	return {map};
+}
+
+namespace traits {
+
+template <typename T>
+struct is_indexed_map : std::false_type {};
+template <typename Map>
+struct is_indexed_map<IndexedMap<Map>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_indexed_map_v = is_indexed_map<T>::value;
+
+}
+
+template<typename Map>
+struct Converter<IndexedMap<Map>> {
+	using value_type = IndexedMap<Map>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.map;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		adapter % x.map;
+	}
+};
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "Converter.h"
+
+namespace serializer {
+
+enum class IntegerEncoding : std::uint8_t {
+	Auto             = 0, // picks the smallest of the others by sampling the first values
+	Plain            = 1, // every value as varint, zigzag for signed types
+	Delta            = 2, // differences to the predecessor as zigzag varints
+	DeltaOfDelta     = 3, // differences of differences as zigzag varints
+	FrameOfReference = 4, // offsets to the minimum, bit-packed with a common width
+};
+
+// Wraps a container of integers (std::vector<std::int64_t>, std::set<std::uint64_t>, ...) so
+// that backends which support it (ebml) write it with a compact sequence encoding:
+//     serializer["timestamps"] % serializer::packed(timestamps, serializer::IntegerEncoding::Delta);
+// Other backends write the container as usual.
+template<typename Container>
+struct PackedIntegers {
+	using container_type = Container;
+	static_assert(std::is_integral_v<typename Container::value_type> and not std::is_same_v<typename Container::value_type, bool>,
+	              "only containers of integers can be packed");
+	Container& container;
+	IntegerEncoding encoding;
+};
+
+template<typename Container>
+PackedIntegers<Container> packed(Container& container, IntegerEncoding encoding = IntegerEncoding::Auto) {
+	return {container, encoding};
+}
+
+namespace traits {
+
+template <typename T>
+struct is_packed_integers : std::false_type {};
+template <typename Container>
+struct is_packed_integers<PackedIntegers<Container>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_packed_integers_v = is_packed_integers<T>::value;
+
+}
+
+template<typename Container>
+struct Converter<PackedIntegers<Container>> {
+	using value_type = PackedIntegers<Container>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.container;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		adapter % x.container;
+	}
+};
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+
+namespace serializer {
+namespace detail {
+
+// every adapter type (ebml::Serializer, json::Deserializer, ...) that takes part in
+// polymorphic dispatch gets a small dense index the first time it is used
+inline std::size_t nextAdapterIndex() {
+	static std::atomic<std::size_t> counter{0};
+	return counter++;
+}
+
+template<typename Adapter>
+std::size_t adapterIndex() {
+	static std::size_t const index = nextAdapterIndex();
+	return index;
+}
+
+inline constexpr std::size_t maxPolymorphAdapters = 32;
+
+// holds one forwarding function per adapter for a single derived type
+template<typename Base>
+struct PolymorphTable {
+private:
+	using Thunk = void(*)();
+	std::array<std::atomic<Thunk>, maxPolymorphAdapters> slots{};
+
+public:
+	template<typename Adapter>
+	void set(void(*forward)(Adapter&, Base&)) {
+		auto index = adapterIndex<Adapter>();
+		if (index >= slots.size()) {
+			throw std::length_error("too many serializer backends for polymorphic dispatch");
+		}
+		slots[index].store(reinterpret_cast<Thunk>(forward), std::memory_order_release);
+	}
+
+	template<typename Adapter>
+	auto get() const -> void(*)(Adapter&, Base&) {
+		auto index = adapterIndex<Adapter>();
+		if (index >= slots.size()) {
+			return nullptr;
+		}
+		return reinterpret_cast<void(*)(Adapter&, Base&)>(slots[index].load(std::memory_order_acquire));
+	}
+};
+
+template<typename Base, typename Deriv>
+PolymorphTable<Base>& polymorphTable() {
+	static PolymorphTable<Base> table;
+	return table;
+}
+
+// forwards a Base that is a Deriv to the serialize function of Deriv for Adapter
+template<typename Adapter, typename Base, typename Deriv>
+struct PolymorphBinding {
+	static void forward(Adapter& adapter, Base& b) {
+		adapter % static_cast<Deriv&>(b);
+	}
+};
+
+}
+}
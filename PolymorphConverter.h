@@ -1,16 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <string>
-#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
 #include <type_traits>
 #include <typeinfo>
 #include <typeindex>
+#include <utility>
 
-#include "yaml/Serializer.h"
-#include "yaml/Deserializer.h"
-#include "ebml/Serializer.h"
-#include "ebml/Deserializer.h"
+#include "Converter.h"
+#include "PolymorphBinding.h"
 
 #include "demangle.h"
 
@@ -20,49 +26,217 @@ namespace serializer {
 template<typename Base>
 struct FactoryBase;
 
+// Registry of all factories of a Base.
+// Lookups are lock free: readers only load the current table and probe its atomic slots.
+// Writers are serialized by a mutex, they fill or tombstone single slots (O(1) expected) and
+// publish a rebuilt table when it runs full. A replaced table is freed as soon as the readers
+// that might still probe it left, so besides the current table none is kept.
+// A factory must not be destroyed while its type is being (de)serialized.
 template<typename Base>
 struct FactoryCollection {
 private:
-    std::unordered_map<std::string, FactoryBase<Base> const&> factories;
+    using Slot = std::atomic<std::uintptr_t>;
+    static constexpr std::uintptr_t empty     = 0;
+    static constexpr std::uintptr_t tombstone = 1;
+
+    struct Table {
+        std::size_t mask;
+        std::unique_ptr<Slot[]> byName;
+        std::unique_ptr<Slot[]> byType;
+        // live entries plus tombstones per array, only accessed by writers
+        std::size_t usedByName{0};
+        std::size_t usedByType{0};
+        std::size_t live{0};
+
+        bool full() const {
+            return 2 * (std::max(usedByName, usedByType) + 1) > mask + 1;
+        }
+
+        Table(std::size_t capacity)
+            : mask{capacity-1}
+            , byName{std::make_unique<Slot[]>(capacity)}
+            , byType{std::make_unique<Slot[]>(capacity)}
+        {}
+    };
+
+    // Readers announce themselves in the counter of the current epoch, spread over cache lines so that
+    // lookups on different threads do not contend. A writer that replaced a table flips the epoch and
+    // waits until the counter of the previous epoch drained, once for each epoch, readers that arrive
+    // meanwhile count towards the new epoch and cannot keep it waiting.
+    struct alignas(64) ReaderCount {
+        std::atomic<std::size_t> value{0};
+    };
+    static constexpr std::size_t stripes = 16;
+
+    std::mutex writeMutex;
+    std::unique_ptr<Table> table;
+    std::atomic<Table const*> current{nullptr};
+    std::atomic<std::size_t> epoch{0};
+    mutable ReaderCount readers[2][stripes];
+
+    class ReadGuard {
+        std::atomic<std::size_t>& count;
+
+        static std::size_t stripe() {
+            static thread_local std::size_t const index = std::hash<std::thread::id>{}(std::this_thread::get_id()) % stripes;
+            return index;
+        }
+    public:
+        ReadGuard(FactoryCollection const& collection)
+            : count{collection.readers[collection.epoch.load(std::memory_order_relaxed) & 1][stripe()].value}
+        {
+            // sequentially consistent with the load of the table and the publishing of a new one, a writer
+            // that sees no readers after publishing has no reader left that loaded the old table
+            count.fetch_add(1, std::memory_order_seq_cst);
+        }
+        ~ReadGuard() {
+            count.fetch_sub(1, std::memory_order_release);
+        }
+        ReadGuard(ReadGuard const&) = delete;
+        ReadGuard& operator=(ReadGuard const&) = delete;
+    };
+
+    // waits until no reader probes a table that was replaced before
+    void synchronize() {
+        for (int i{0}; i < 2; ++i) {
+            auto previous = epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+            for (auto& count : readers[previous]) {
+                while (count.value.load(std::memory_order_seq_cst) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    static FactoryBase<Base> const* decode(std::uintptr_t v) {
+        return reinterpret_cast<FactoryBase<Base> const*>(v);
+    }
+
+    static std::size_t hash(std::string_view name) {
+        return std::hash<std::string_view>{}(name);
+    }
+    static std::size_t hash(std::type_info const& info) {
+        return std::type_index{info}.hash_code();
+    }
+
+    template<typename Key, typename Pred>
+    static FactoryBase<Base> const* find(Slot const* slots, std::size_t mask, Key const& key, Pred&& pred) {
+        for (auto i = hash(key) & mask; ; i = (i+1) & mask) {
+            auto v = slots[i].load(std::memory_order_acquire);
+            if (v == empty) {
+                return nullptr;
+            }
+            if (v != tombstone and pred(*decode(v))) {
+                return decode(v);
+            }
+        }
+    }
+
+    // the caller made sure that there is a free slot
+    template<typename Key>
+    static bool insert(Slot* slots, std::size_t mask, Key const& key, FactoryBase<Base> const& factory) {
+        for (auto i = hash(key) & mask; ; i = (i+1) & mask) {
+            auto v = slots[i].load(std::memory_order_relaxed);
+            if (v == empty or v == tombstone) {
+                slots[i].store(reinterpret_cast<std::uintptr_t>(&factory), std::memory_order_release);
+                return v == empty;
+            }
+        }
+    }
+
+    template<typename Key>
+    static void erase(Slot* slots, std::size_t mask, Key const& key, FactoryBase<Base> const& factory) {
+        for (auto i = hash(key) & mask; ; i = (i+1) & mask) {
+            auto v = slots[i].load(std::memory_order_relaxed);
+            if (v == empty) {
+                return;
+            }
+            if (v == reinterpret_cast<std::uintptr_t>(&factory)) {
+                slots[i].store(tombstone, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+    void rebuild() {
+        auto live = table ? table->live : 0;
+        std::size_t capacity = 64;
+        while (capacity < 4 * (live + 1)) {
+            capacity *= 2;
+        }
+        auto next = std::make_unique<Table>(capacity);
+        if (table) {
+            for (std::size_t i{0}; i <= table->mask; ++i) {
+                auto v = table->byName[i].load(std::memory_order_relaxed);
+                if (v != empty and v != tombstone) {
+                    auto const& factory = *decode(v);
+                    insert(next->byName.get(), next->mask, factory.getName(), factory);
+                    insert(next->byType.get(), next->mask, factory.getTypeInfo(), factory);
+                    ++next->usedByName;
+                    ++next->usedByType;
+                    ++next->live;
+                }
+            }
+        }
+        current.store(next.get(), std::memory_order_seq_cst);
+        auto old = std::exchange(table, std::move(next));
+        if (old) {
+            synchronize();
+        }
+    }
 
-    using ReverseMappedType = typename std::map<std::string, FactoryBase<Base> const&>::value_type;
-    std::unordered_multimap<std::type_index, ReverseMappedType const*> reverse_lokup;
-    
 public:
     static FactoryCollection& get() {
         static FactoryCollection instance{};
         return instance;
     }
 
-    void addFactory(std::string const& name, FactoryBase<Base> const& factory) {
-        auto res = factories.emplace(name, factory);
-        if (res.second) {
-            reverse_lokup.emplace(factory.getTypeInfo(), &(*res.first));
+    void addFactory(FactoryBase<Base> const& factory) {
+        std::lock_guard lock{writeMutex};
+        if (not table or table->full()) {
+            rebuild();
         }
+        auto const& name = factory.getName();
+        if (find(table->byName.get(), table->mask, name, [&](auto const& f) { return f.getName() == name; })) {
+            return;
+        }
+        table->usedByType += insert(table->byType.get(), table->mask, factory.getTypeInfo(), factory);
+        table->usedByName += insert(table->byName.get(), table->mask, name, factory);
+        ++table->live;
     }
 
     void removeFactory(FactoryBase<Base> const& factory) {
-        auto it = std::find_if(begin(factories), end(factories), [&](auto const& a) { return &a.second==&factory; });
-        if (it != factories.end() and &it->second == &factory) {
-            auto other_it = std::find_if(begin(reverse_lokup), end(reverse_lokup), [&](auto const& a) { return a.second==&(*it); });
-            reverse_lokup.erase(other_it);
-            factories.erase(it);
+        std::lock_guard lock{writeMutex};
+        if (not table) {
+            return;
+        }
+        auto const& name = factory.getName();
+        if (find(table->byName.get(), table->mask, name, [&](auto const& f) { return &f == &factory; })) {
+            erase(table->byName.get(), table->mask, name, factory);
+            erase(table->byType.get(), table->mask, factory.getTypeInfo(), factory);
+            --table->live;
         }
     }
 
-    FactoryBase<Base> const* getFactory(std::string const& name) const {
-        auto it = factories.find(name);
-        if (it == factories.end()) {
+    FactoryBase<Base> const* getFactory(std::string_view name) const {
+        ReadGuard guard{*this};
+        auto probed = current.load(std::memory_order_seq_cst);
+        if (not probed) {
             return nullptr;
         }
-        return &it->second;
+        return find(probed->byName.get(), probed->mask, name, [&](auto const& f) { return f.getName() == name; });
     }
-    ReverseMappedType const& getFactory(std::type_info const& info) const {
-        auto it = reverse_lokup.find(std::type_index{info});
-        if (it == reverse_lokup.end()) {
+
+    FactoryBase<Base> const& getFactory(std::type_info const& info) const {
+        auto factory = [&]() -> FactoryBase<Base> const* {
+            ReadGuard guard{*this};
+            auto probed = current.load(std::memory_order_seq_cst);
+            return probed ? find(probed->byType.get(), probed->mask, info, [&](auto const& f) { return f.getTypeInfo() == info; }) : nullptr;
+        }();
+        if (not factory) {
             throw std::runtime_error("there is no factory for type: " + demangle(info));
         }
-        return *it->second;
+        return *factory;
     }
 };
 
@@ -71,17 +245,63 @@ struct FactoryBase {
     virtual std::unique_ptr<Base> build() const = 0;
     virtual std::type_info const& getTypeInfo() const = 0;
 
-    virtual void forwardSerializer(yaml::Serializer& ser, Base& b) const = 0;
-    virtual void forwardSerializer(yaml::Deserializer& ser, Base& b) const = 0;
-    virtual void forwardSerializer(ebml::Serializer& ser, Base& b) const = 0;
-    virtual void forwardSerializer(ebml::Deserializer& ser, Base& b) const = 0;
+    // default constructs the derived type into memory of at least getSize() bytes aligned to getAlignment()
+    virtual Base* construct(void* memory) const = 0;
+    virtual std::size_t getSize() const = 0;
+    virtual std::size_t getAlignment() const = 0;
+
+    // builds the derived type inside of resource (an arena, a pool, ...), the returned object has to be
+    // released with ResourceDeleter<Base>{&resource, getSize(), getAlignment()}
+    Base* build(std::pmr::memory_resource& resource) const {
+        auto memory = resource.allocate(getSize(), getAlignment());
+        try {
+            return construct(memory);
+        } catch (...) {
+            resource.deallocate(memory, getSize(), getAlignment());
+            throw;
+        }
+    }
+
+    std::string const& getName() const {
+        return name;
+    }
+
+    // dispatches to the serialize function of the derived type, works for the backends that its
+    // Factory lists
+    template<typename Adapter>
+    void forwardSerializer(Adapter& ser, Base& b) const {
+        auto forward = table.template get<Adapter>();
+        if (not forward) {
+            throw std::runtime_error("there is no polymorphic binding of type " + demangle(getTypeInfo()) + " for " + demangle<Adapter>());
+        }
+        forward(ser, b);
+    }
+
+protected:
+    FactoryBase(std::string const& _name, detail::PolymorphTable<Base> const& _table)
+        : name{_name}
+        , table{_table}
+    {}
+
+private:
+    std::string name;
+    detail::PolymorphTable<Base> const& table;
 };
 
-template<typename Base, typename Deriv>
+// Makes Deriv known as a derived type of Base under name and binds it to Backends, the adapters that
+// (de)serialize it (ebml::Serializer, json::Deserializer, ...):
+//     serializer::Factory<Base, Derived, serializer::ebml::Serializer, serializer::ebml::Deserializer> factory{"Derived"};
+// Every backend that meets a Derived has to be listed, the others throw. The list is part of the type, which
+// backends are bound does not depend on the headers that happen to be included where the factory is defined.
+template<typename Base, typename Deriv, typename... Backends>
 struct Factory : FactoryBase<Base> {
-    Factory(std::string const& name) {
+    Factory(std::string const& name)
+        : FactoryBase<Base>(name, detail::polymorphTable<Base, Deriv>())
+    {
+        auto& table = detail::polymorphTable<Base, Deriv>();
+        (table.template set<Backends>(&detail::PolymorphBinding<Backends, Base, Deriv>::forward), ...);
         auto& collection = FactoryCollection<Base>::get();
-        collection.addFactory(name, *this);
+        collection.addFactory(*this);
     }
     virtual ~Factory() {
         auto& collection = FactoryCollection<Base>::get();
@@ -96,77 +316,266 @@ struct Factory : FactoryBase<Base> {
         return typeid(Deriv);
     }
 
-    void forwardSerializer(yaml::Serializer& ser, Base& b) const override {
-        ser % static_cast<Deriv&>(b);
+    Base* construct(void* memory) const override {
+        return ::new (memory) Deriv();
     }
-    void forwardSerializer(yaml::Deserializer& ser, Base& b) const override {
-        ser % static_cast<Deriv&>(b);
+    std::size_t getSize() const override {
+        return sizeof(Deriv);
     }
-    void forwardSerializer(ebml::Serializer& ser, Base& b) const override {
-        ser % static_cast<Deriv&>(b);
+    std::size_t getAlignment() const override {
+        return alignof(Deriv);
+    }
+};
+
+namespace detail {
+
+inline thread_local std::pmr::memory_resource* currentResource{nullptr};
+
+}
+
+// While a ResourceScope is alive, polymorphic ResourcePtrs without a resource of their own and
+// polymorphic raw pointers are deserialized into the given resource on this thread.
+// Use a std::pmr::monotonic_buffer_resource as arena or a std::pmr::unsynchronized_pool_resource
+// to get pools per object size.
+struct ResourceScope {
+private:
+    std::pmr::memory_resource* previous;
+public:
+    ResourceScope(std::pmr::memory_resource& resource)
+        : previous{std::exchange(detail::currentResource, &resource)}
+    {}
+    ~ResourceScope() {
+        detail::currentResource = previous;
     }
-    void forwardSerializer(ebml::Deserializer& ser, Base& b) const override {
-        ser % static_cast<Deriv&>(b);
+    ResourceScope(ResourceScope const&) = delete;
+    ResourceScope& operator=(ResourceScope const&) = delete;
+
+    static std::pmr::memory_resource* current() {
+        return detail::currentResource;
     }
 };
 
+template<typename Base>
+struct ResourceDeleter {
+    std::pmr::memory_resource* resource{nullptr};
+    // of the derived type, recorded when it was built
+    std::size_t size{0};
+    std::size_t alignment{0};
+
+    void operator()(Base* b) const {
+        void* memory = dynamic_cast<void*>(b);
+        b->~Base();
+        resource->deallocate(memory, size, alignment);
+    }
+};
+
+template<typename Base>
+using ResourcePtr = std::unique_ptr<Base, ResourceDeleter<Base>>;
+
+
+namespace detail {
+
+template<typename Base, typename Serializer>
+void serializePolymorph(Serializer& adapter, Base& b) {
+    auto const& collection = FactoryCollection<Base>::get();
+    auto const& factory = collection.getFactory(typeid(b));
+
+    adapter["specialization"] % factory.getName();
+    auto&& subSer = adapter["content"];
+    factory.forwardSerializer(subSer, b);
+}
+
+// a null pointer holds no object, its element is omitted and positional backends write an empty name
+template<typename Serializer>
+void serializeNoPolymorph(Serializer& adapter) {
+    if constexpr (requires { adapter.omit(); }) {
+        adapter.omit();
+    } else {
+        std::string none;
+        adapter["specialization"] % none;
+    }
+}
+
+// build(factory) has to create the object and return a reference to it,
+// at that point the object is already reachable for back-references of its content.
+// Returns false if the document holds no object.
+template<typename Base, typename Deserializer, typename Build>
+bool deserializePolymorph(Deserializer& adapter, Build&& build) {
+    auto const& collection = FactoryCollection<Base>::get();
+
+    auto&& specialization = adapter["specialization"];
+    if (not isPresent(specialization)) {
+        return false;
+    }
+    std::string name;
+    specialization % name;
+    if (name.empty()) {
+        return false;
+    }
+
+    auto factory = collection.getFactory(name);
+    if (not factory) {
+        // maybe its better to throw an exeption here... dunno
+        return true;
+    }
+
+    Base& b = build(*factory);
+    auto&& subSer = adapter["content"];
+    factory->forwardSerializer(subSer, b);
+    return true;
+}
+
+inline std::pmr::memory_resource* selectResource(std::pmr::memory_resource* resource) {
+    if (not resource) {
+        resource = ResourceScope::current();
+    }
+    if (not resource) {
+        resource = std::pmr::get_default_resource();
+    }
+    return resource;
+}
+
+}
 
 template<typename Base>
 struct Converter<std::unique_ptr<Base>, typename std::enable_if<std::is_polymorphic_v<Base>>::type> {
 	using value_type = std::unique_ptr<Base>;
-    
+
 	template<typename Serializer>
 	void serialize(Serializer& adapter, value_type& x) {
-        auto const& collection = FactoryCollection<Base>::get();
-		auto const& info = collection.getFactory(typeid(*x));
-
-        adapter["specialization"] % info.first;
-        auto&& subSer = adapter["content"];
-        info.second.forwardSerializer(subSer, *x);
+        if (not x) {
+            detail::serializeNoPolymorph(adapter);
+            return;
+        }
+        detail::serializePolymorph(adapter, *x);
 	}
 
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, value_type& x) {
-        auto const& collection = FactoryCollection<Base>::get();
+        auto found = detail::deserializePolymorph<Base>(adapter, [&](auto const& factory) -> Base& {
+            // in update mode an object of the same type is decoded into
+            if (not x or factory.getTypeInfo() != typeid(*x) or not detail::isUpdating(adapter)) {
+                x = factory.build();
+            }
+            return *x;
+        });
+        if (not found) {
+            x.reset();
+        }
+	}
+};
 
-        std::string name;
-		adapter["specialization"] % name;
+template<typename Base>
+struct Converter<ResourcePtr<Base>, typename std::enable_if<std::is_polymorphic_v<Base>>::type> {
+	using value_type = ResourcePtr<Base>;
 
-		auto factory = collection.getFactory(name);
-        if (not factory) {
-            // maybe its better to throw an exeption here... dunno
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+        if (not x) {
+            detail::serializeNoPolymorph(adapter);
             return;
         }
+        detail::serializePolymorph(adapter, *x);
+	}
 
-        x = factory->build();
-        auto&& subSer = adapter["content"];
-        factory->forwardSerializer(subSer, *x);
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+        auto resource = detail::selectResource(x.get_deleter().resource);
+        auto found = detail::deserializePolymorph<Base>(adapter, [&](auto const& factory) -> Base& {
+            if (not x or factory.getTypeInfo() != typeid(*x) or not detail::isUpdating(adapter)) {
+                x = value_type{factory.build(*resource), {resource, factory.getSize(), factory.getAlignment()}};
+            }
+            return *x;
+        });
+        if (not found) {
+            x.reset();
+        }
 	}
 };
 
+// Raw pointers are tracked by identity: an object that is referenced multiple times
+// is written once and every further occurrence is a back-reference to its id.
 template<typename Base>
 struct Converter<Base*, typename std::enable_if<std::is_polymorphic_v<Base>>::type> {
 	using value_type = Base*;
-    
+
 	template<typename Serializer>
 	void serialize(Serializer& adapter, value_type& x) {
-        auto const& collection = FactoryCollection<Base>::get();
-		auto const& info = collection.getFactory(typeid(*x));
-
-        adapter["specialization"] % info.first;
-        auto&& subSer = adapter["content"];
-        info.second.forwardSerializer(subSer, *x);
+        if (detail::writeObjectId(adapter, x ? dynamic_cast<void const*>(x) : nullptr)) {
+            detail::serializePolymorph(adapter, *x);
+        }
 	}
 
 	template<typename Deserializer>
 	void deserialize(Deserializer& adapter, value_type& x) {
-        Converter<std::unique_ptr<Base>> conv;
-        std::unique_ptr<Base> ptr;
-        conv.deserialize(adapter, ptr);
-        x = ptr.release();
+        auto resource = ResourceScope::current();
+        auto build = [&](auto const& factory) -> Base& {
+            x = resource ? factory.build(*resource) : factory.build().release();
+            return *x;
+        };
+        auto&& idAdapter = adapter["id"];
+        if (not detail::isPresent(idAdapter)) {
+            // documents from before objects were tracked hold every occurrence as a copy without an id
+            x = nullptr;
+            detail::deserializePolymorph<Base>(adapter, build);
+            return;
+        }
+        std::uint64_t id{0};
+        idAdapter % id;
+        if (id == 0) {
+            x = nullptr;
+            return;
+        }
+        auto& objects = adapter.getContext().template get<detail::SharedObjects>().objects;
+        if (auto it = objects.find(id); it != objects.end()) {
+            x = static_cast<Base*>(it->second.get());
+            return;
+        }
+        auto found = detail::deserializePolymorph<Base>(adapter, [&](auto const& factory) -> Base& {
+            build(factory);
+            // the document does not own raw pointers
+            objects.emplace(id, std::shared_ptr<void>{std::shared_ptr<void>{}, x});
+            return *x;
+        });
+        if (not found) {
+            detail::missingObject(id);
+        }
 	}
 };
 
-}
+template<typename Base>
+struct Converter<std::shared_ptr<Base>, typename std::enable_if<std::is_polymorphic_v<Base>>::type> {
+	using value_type = std::shared_ptr<Base>;
+
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+        if (detail::writeObjectId(adapter, x ? dynamic_cast<void const*>(x.get()) : nullptr)) {
+            detail::serializePolymorph(adapter, *x);
+        }
+	}
 
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+        std::uint64_t id{0};
+        adapter["id"] % id;
+        if (id == 0) {
+            x.reset();
+            return;
+        }
+        auto& objects = adapter.getContext().template get<detail::SharedObjects>().objects;
+        if (auto it = objects.find(id); it != objects.end()) {
+            x = std::static_pointer_cast<Base>(it->second);
+            return;
+        }
+        auto found = detail::deserializePolymorph<Base>(adapter, [&](auto const& factory) -> Base& {
+            x = factory.build();
+            objects.emplace(id, x);
+            return *x;
+        });
+        if (not found) {
+            detail::missingObject(id);
+        }
+	}
+};
 
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <typeindex>
+#include <variant>
+#include <vector>
+
+#include "Columnar.h"
+#include "Compression.h"
+#include "Context.h"
+#include "Converter.h"
+#include "IntegerEncoding.h"
+#include "demangle.h"
+#include "traits.h"
+
+namespace serializer {
+
+// The shape of a type as its serialize function writes it, without any values.
+// Derived with makeSchema<T>(), transcode() uses it to convert documents between backends.
+struct Schema {
+	enum class Kind : std::uint8_t {
+		Bool,
+		Signed,
+		Unsigned,
+		Float,
+		String,
+		Object,     // children are the fields, each with its name
+		Sequence,   // children[0] is the element
+		Map,        // children[0] is the key, children[1] the value
+		Optional,   // children[0] is the value
+		Variant,    // children are the alternatives
+		Tuple,      // children are the positional members
+		Packed,     // packed integers, children[0] is the element (Signed or Unsigned)
+		Compressed, // children[0] is the compressed value
+		Columnar,   // sequence of records written column by column, children[0] is the record
+	};
+	Kind kind{Kind::Object};
+	std::string name;
+	std::vector<Schema> children;
+
+	// bytes of Bool, Signed, Unsigned and Float values in memory
+	std::size_t width{0};
+
+	// write options of Packed and Compressed
+	IntegerEncoding encoding{IntegerEncoding::Auto};
+	Codec codec{Codec::None};
+	std::size_t blockSize{0};
+};
+
+namespace detail {
+
+template<typename T>
+struct is_pointer_like : std::is_pointer<T> {};
+template<typename T, typename D>
+struct is_pointer_like<std::unique_ptr<T, D>> : std::true_type {};
+template<typename T>
+struct is_pointer_like<std::shared_ptr<T>> : std::true_type {};
+template<typename T>
+struct is_pointer_like<std::weak_ptr<T>> : std::true_type {};
+
+// Serializer that runs serialize functions and converters on default constructed values and
+// records what they write. Element types of containers are recorded from a default constructed element.
+struct SchemaRecorder : traits::SerializerTraits<false> {
+private:
+	struct State {
+		Context context;
+		// types whose fields are being recorded, a type that contains itself has no finite schema
+		std::vector<std::type_index> active;
+	};
+	Schema* schema;
+	std::shared_ptr<State> state;
+
+	SchemaRecorder(Schema& _schema, std::shared_ptr<State> _state)
+		: schema{&_schema}, state{std::move(_state)} {}
+
+	template<typename T>
+	void record(Schema& target) {
+		T value{};
+		SchemaRecorder{target, state} % value;
+	}
+
+	template<typename... Ts>
+	void recordAlternatives(std::variant<Ts...> const*) {
+		(record<Ts>(schema->children.emplace_back()), ...);
+	}
+
+public:
+	SchemaRecorder(Schema& _schema)
+		: schema{&_schema}, state{std::make_shared<State>()} {}
+
+	SchemaRecorder operator[](std::string_view name) {
+		schema->kind = Schema::Kind::Object;
+		auto& field = schema->children.emplace_back();
+		field.name = name;
+		return {field, state};
+	}
+
+	Context& getContext() {
+		return state->context;
+	}
+
+	template<typename T>
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		using Kind = Schema::Kind;
+
+		if constexpr (std::is_arithmetic_v<value_type>) {
+			schema->width = sizeof(value_type);
+		}
+		if constexpr (std::is_same_v<value_type, bool>) {
+			schema->kind = Kind::Bool;
+		} else if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
+			schema->kind = Kind::String;
+		} else if constexpr (std::is_integral_v<value_type>) {
+			schema->kind = std::is_signed_v<value_type> ? Kind::Signed : Kind::Unsigned;
+		} else if constexpr (std::is_floating_point_v<value_type>) {
+			schema->kind = Kind::Float;
+		} else if constexpr (std::is_enum_v<value_type>) {
+			(*this) % std::underlying_type_t<value_type>{};
+		} else if constexpr (traits::is_optional_v<value_type>) {
+			schema->kind = Kind::Optional;
+			record<typename value_type::value_type>(schema->children.emplace_back());
+		} else if constexpr (traits::is_variant_v<value_type>) {
+			schema->kind = Kind::Variant;
+			recordAlternatives(static_cast<value_type const*>(nullptr));
+		} else if constexpr (traits::is_map_v<value_type>) {
+			schema->kind = Kind::Map;
+			record<typename value_type::key_type>(schema->children.emplace_back());
+			record<typename value_type::mapped_type>(schema->children.emplace_back());
+		} else if constexpr (traits::is_packed_integers_v<value_type>) {
+			schema->kind     = Kind::Packed;
+			schema->encoding = t.encoding;
+			record<typename value_type::container_type::value_type>(schema->children.emplace_back());
+		} else if constexpr (traits::is_columnar_v<value_type>) {
+			schema->kind = Kind::Columnar;
+			record<typename value_type::container_type::value_type>(schema->children.emplace_back());
+		} else if constexpr (traits::is_compressed_v<value_type>) {
+			schema->kind      = Kind::Compressed;
+			schema->codec     = t.codec;
+			schema->blockSize = t.blockSize;
+			SchemaRecorder{schema->children.emplace_back(), state} % t.value;
+		} else if constexpr (is_pointer_like<value_type>::value) {
+			throw std::invalid_argument("cannot derive a schema of " + demangle<value_type>() + ", pointers are not supported");
+		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
+			auto& active = state->active;
+			if (std::find(active.begin(), active.end(), std::type_index{typeid(value_type)}) != active.end()) {
+				throw std::invalid_argument("cannot derive a schema of the recursive type " + demangle<value_type>());
+			}
+			schema->kind = Kind::Object;
+			active.emplace_back(typeid(value_type));
+			t.serialize(*this);
+			active.pop_back();
+		} else {
+			// last resort is using a converter
+			Converter<value_type> converter;
+			converter.serialize(*this, t);
+		}
+	}
+
+	template<typename IterT>
+	void serializeSequence(IterT, IterT) {
+		schema->kind = Schema::Kind::Sequence;
+		record<typename std::iterator_traits<IterT>::value_type>(schema->children.emplace_back());
+	}
+
+	template<typename ElemCb>
+	void serializeElement(ElemCb&& cb) {
+		schema->kind = Schema::Kind::Tuple;
+		SchemaRecorder elem{schema->children.emplace_back(), state};
+		cb(elem);
+	}
+};
+
+}
+
+template<typename T>
+Schema makeSchema() {
+	Schema schema;
+	T value{};
+	detail::SchemaRecorder{schema} % value;
+	return schema;
+}
+
+}
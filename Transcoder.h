@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Columnar.h"
+#include "Compression.h"
+#include "IntegerEncoding.h"
+#include "Schema.h"
+
+namespace serializer {
+
+namespace detail {
+
+// gives a callable a serialize function, so it can be passed through wrappers like compressed()
+template<typename F>
+struct SerializeCallback {
+	F f;
+	template<typename Adapter>
+	void serialize(Adapter& adapter) {
+		f(adapter);
+	}
+};
+template<typename F>
+SerializeCallback(F) -> SerializeCallback<F>;
+
+template<typename T, typename Source, typename Target>
+void transcodeScalar(Source& source, Target& target) {
+	T value{};
+	source % value;
+	target % value;
+}
+
+template<typename T, typename Source, typename Target>
+void transcodePacked(Schema const& schema, Source& source, Target& target) {
+	std::vector<T> values;
+	source % packed(values);
+	target % packed(values, schema.encoding);
+}
+
+// the record schema of the columnar sequence that is transcoded on this thread, records take it when they are built
+inline thread_local Schema const* columnarRecord{nullptr};
+
+// a record of a columnar sequence that holds the fields of its schema, every field is written and read with
+// the type of its column
+struct ColumnarRecord {
+	using Value = std::variant<bool, std::int64_t, std::uint64_t, float, double, std::string>;
+	Schema const* schema{columnarRecord};
+	std::vector<Value> values;
+
+	template<typename T, typename Node>
+	static void field(Node& node, std::string const& name, Value& value) {
+		if (not std::holds_alternative<T>(value)) {
+			value.template emplace<T>();
+		}
+		node[name] % std::get<T>(value);
+	}
+
+	template<typename Node>
+	void serialize(Node& node) {
+		using Kind = Schema::Kind;
+		values.resize(schema->children.size());
+		for (std::size_t i{0}; i < values.size(); ++i) {
+			auto const& f = schema->children[i];
+			switch (f.kind) {
+			case Kind::Bool:
+				field<bool>(node, f.name, values[i]);
+				break;
+			case Kind::Signed:
+				field<std::int64_t>(node, f.name, values[i]);
+				break;
+			case Kind::Unsigned:
+				field<std::uint64_t>(node, f.name, values[i]);
+				break;
+			case Kind::Float:
+				if (f.width == sizeof(float)) {
+					field<float>(node, f.name, values[i]);
+				} else {
+					field<double>(node, f.name, values[i]);
+				}
+				break;
+			case Kind::String:
+				field<std::string>(node, f.name, values[i]);
+				break;
+			default:
+				throw std::invalid_argument("records of columnar sequences can only hold scalars, enums and strings");
+			}
+		}
+	}
+};
+
+template<typename Source, typename Target>
+void transcodeColumnar(Schema const& schema, Source& source, Target& target) {
+	struct Scope {
+		Schema const* previous;
+		~Scope() {
+			columnarRecord = previous;
+		}
+	} scope{std::exchange(columnarRecord, &schema.children[0])};
+	std::vector<ColumnarRecord> records;
+	source % columnar(records);
+	target % columnar(records);
+}
+
+template<typename Source, typename Target>
+void transcodeNode(Schema const& schema, Source& source, Target& target) {
+	using Kind = Schema::Kind;
+	switch (schema.kind) {
+	case Kind::Bool:
+		transcodeScalar<bool>(source, target);
+		return;
+	case Kind::Signed:
+		transcodeScalar<std::int64_t>(source, target);
+		return;
+	case Kind::Unsigned:
+		transcodeScalar<std::uint64_t>(source, target);
+		return;
+	case Kind::Float:
+		transcodeScalar<double>(source, target);
+		return;
+	case Kind::String:
+		transcodeScalar<std::string>(source, target);
+		return;
+	case Kind::Object:
+		for (auto const& field : schema.children) {
+			auto fieldSource = source[field.name];
+			auto fieldTarget = target[field.name];
+			if (fieldSource.present()) {
+				transcodeNode(field, fieldSource, fieldTarget);
+			} else {
+				fieldTarget.omit();
+			}
+		}
+		return;
+	case Kind::Sequence:
+		detail::beginSequence(target);
+		source.deserializeElements([&](auto& elemSource) {
+			target.serializeElement([&](auto& elemTarget) {
+				transcodeNode(schema.children[0], elemSource, elemTarget);
+			});
+		});
+		return;
+	case Kind::Map:
+		detail::beginMap(target, schema.children[0].kind == Kind::String);
+		source.deserializeEntries([&](auto& keySource, auto& valueSource) {
+			target.serializeEntry(
+				[&](auto& keyTarget) { transcodeNode(schema.children[0], keySource, keyTarget); },
+				[&](auto& valueTarget) { transcodeNode(schema.children[1], valueSource, valueTarget); });
+		});
+		return;
+	case Kind::Optional:
+		if (source.present()) {
+			transcodeNode(schema.children[0], source, target);
+		} else {
+			target.omit();
+		}
+		return;
+	case Kind::Variant: {
+		// the index of the alternative followed by its value, see Converter<std::variant>
+		std::size_t i{0};
+		std::uint32_t index{0};
+		source.deserializeElements([&](auto& elemSource) {
+			if (i == 0) {
+				elemSource % index;
+				if (index >= schema.children.size()) {
+					throw std::runtime_error("variant index out of range");
+				}
+				target.serializeElement([&](auto& elemTarget) { elemTarget % index; });
+			} else if (i == 1) {
+				target.serializeElement([&](auto& elemTarget) {
+					transcodeNode(schema.children[index], elemSource, elemTarget);
+				});
+			}
+			++i;
+		});
+		return;
+	}
+	case Kind::Tuple: {
+		std::size_t i{0};
+		source.deserializeElements([&](auto& elemSource) {
+			if (i < schema.children.size()) {
+				target.serializeElement([&](auto& elemTarget) {
+					transcodeNode(schema.children[i], elemSource, elemTarget);
+				});
+			}
+			++i;
+		});
+		return;
+	}
+	case Kind::Packed:
+		if (schema.children[0].kind == Kind::Signed) {
+			transcodePacked<std::int64_t>(schema, source, target);
+		} else {
+			transcodePacked<std::uint64_t>(schema, source, target);
+		}
+		return;
+	case Kind::Compressed: {
+		auto reader = SerializeCallback{[&](auto& innerSource) {
+			auto writer = SerializeCallback{[&](auto& innerTarget) {
+				transcodeNode(schema.children[0], innerSource, innerTarget);
+			}};
+			target % compressed(writer, schema.codec, schema.blockSize);
+		}};
+		source % compressed(reader);
+		return;
+	}
+	case Kind::Columnar:
+		transcodeColumnar(schema, source, target);
+		return;
+	}
+}
+
+}
+
+// Converts a document between backends in a single pass, without constructing the types it
+// was written from. The schema describes them and is derived from their serialize functions:
+//     auto schema = serializer::makeSchema<Snapshot>();
+//     serializer::ebml::Deserializer source{buffer.data(), buffer.size()};
+//     serializer::json::Serializer target;
+//     serializer::transcode(schema, source["snapshot"], target["snapshot"]);
+// Values are streamed one at a time, only packed integer sequences and columnar sequences are
+// held as a whole.
+template<typename Source, typename Target>
+void transcode(Schema const& schema, Source&& source, Target&& target) {
+	detail::transcodeNode(schema, source, target);
+}
+
+}
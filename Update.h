@@ -0,0 +1,49 @@
+#pragma once
+
+#include <utility>
+
+#include "Converter.h"
+
+namespace serializer {
+
+// Wraps a value so that deserializing reuses what it already holds instead of rebuilding it:
+//     deserializer["state"] % serializer::update(state);
+// Vectors are decoded element wise into their existing elements, map and set nodes are
+// recycled (entries with a matching key keep their value, new keys start from a default
+// one), strings keep their capacity and owned polymorphic objects of unchanged type are
+// decoded into. Re-decoding similarly shaped
+// messages into the same long lived object thus allocates next to nothing.
+// Fields missing in the input keep their previous values. Serializing writes the value as usual.
+template<typename T>
+struct Update {
+	using value_type = T;
+	T& value;
+};
+
+template<typename T>
+Update<T> update(T& value) {
+	return {value};
+}
+
+template<typename T>
+struct Converter<Update<T>> {
+	using value_type = Update<T>;
+	template<typename Serializer>
+	void serialize(Serializer& adapter, value_type& x) {
+		adapter % x.value;
+	}
+	template<typename Deserializer>
+	void deserialize(Deserializer& adapter, value_type& x) {
+		auto& mode = detail::updateMode(adapter);
+		auto previous = std::exchange(mode.enabled, true);
+		try {
+			adapter % x.value;
+		} catch (...) {
+			mode.enabled = previous;
+			throw;
+		}
+		mode.enabled = previous;
+	}
+};
+
+}
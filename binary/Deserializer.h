@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "serializer/Context.h"
+#include "serializer/Converter.h"
+#include "serializer/demangle.h"
+#include "serializer/instrumentation.h"
+#include "serializer/traits.h"
+
+#include "format.h"
+
+namespace serializer {
+namespace binary {
+
+namespace detail
+{
+
+// state of one deserialized document, all Deserializers read from the same position
+struct DeserializerDocument {
+	Context context;
+	serializer::detail::UpdateMode updateMode;
+	std::byte const* pos;
+	std::byte const* end;
+};
+
+struct ReadSince {
+	std::byte const* const& pos;
+	std::byte const* start;
+	std::size_t operator()() const {
+		return static_cast<std::size_t>(pos - start);
+	}
+};
+
+template<typename T>
+struct is_flat_vector : std::false_type {};
+template<typename T, typename Alloc>
+struct is_flat_vector<std::vector<T, Alloc>> : std::bool_constant<is_flat_v<T>> {};
+
+}
+
+// reads documents of binary::Serializer, see there for the format
+struct Deserializer : traits::SerializerTraits<true> {
+private:
+	std::shared_ptr<detail::DeserializerDocument> rootDocument;
+	detail::DeserializerDocument* document;
+	bool topLevel{false};
+
+	Deserializer(detail::DeserializerDocument* _document, bool _topLevel)
+		: document{_document}, topLevel{_topLevel} {}
+
+	std::size_t remaining() const {
+		return static_cast<std::size_t>(document->end - document->pos);
+	}
+
+	std::byte const* take(std::size_t size) {
+		if (remaining() < size) {
+			throw std::runtime_error("invalid binary stream! it ends in the middle of a value");
+		}
+		auto data = document->pos;
+		document->pos += size;
+		return data;
+	}
+
+	template<typename T>
+	T readRaw() {
+		T value;
+		std::memcpy(&value, take(sizeof(value)), sizeof(value));
+		return value;
+	}
+
+	std::size_t readCount() {
+		return static_cast<std::size_t>(detail::readCount(document->pos, document->end));
+	}
+
+	// a forged count of empty elements would loop without reading a byte
+	std::size_t readElementCount() {
+		auto count = readCount();
+		if (count > remaining() and count > detail::maxEmptyElements) {
+			throw std::runtime_error("invalid binary stream! more elements than the stream can hold");
+		}
+		return count;
+	}
+
+public:
+	Deserializer(std::byte const* _buffer, std::size_t _size)
+		: rootDocument{std::make_shared<detail::DeserializerDocument>()}
+		, document{rootDocument.get()}
+		, topLevel{true}
+	{
+		document->pos = _buffer;
+		document->end = _buffer + _size;
+		auto magic = readRaw<std::uint32_t>();
+		if (magic == detail::swappedMagic) {
+			throw std::runtime_error("cannot deserialize stream! it was written with a different byte order");
+		}
+		if (magic != detail::magic) {
+			throw std::runtime_error("cannot deserialize stream! wrong document type");
+		}
+	}
+
+	Deserializer operator[](std::string_view) {
+		return {document, topLevel};
+	}
+
+	Context& getContext() {
+		return document->context;
+	}
+
+	serializer::detail::UpdateMode& getUpdateMode() {
+		return document->updateMode;
+	}
+
+	template<typename T>
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		if (topLevel) {
+			if constexpr (detail::is_wrapper_v<value_type>) {
+				Converter<value_type>{}.deserialize(*this, t);
+			} else {
+				if (readRaw<std::uint64_t>() != detail::fingerprint<value_type>()) {
+					throw std::runtime_error("cannot deserialize " + demangle<value_type>() + ", the stream was written with a different layout");
+				}
+				Deserializer{document, false} % t;
+			}
+			return;
+		}
+		SERIALIZER_INSTRUMENT(value_type, Direction::Deserialize, (detail::ReadSince{document->pos, document->pos}));
+
+		if constexpr (std::is_same_v<value_type, bool>) {
+			auto value = readRaw<std::uint8_t>();
+			if (value > 1) {
+				throw std::runtime_error("invalid binary stream! bool that is neither 0 nor 1");
+			}
+			t = value != 0;
+		} else if constexpr (std::is_arithmetic_v<value_type> or std::is_enum_v<value_type>) {
+			t = readRaw<value_type>();
+		} else if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
+			auto size = readCount();
+			auto data = reinterpret_cast<char const*>(take(size));
+			if constexpr (std::is_same_v<value_type, std::string>) {
+				t.assign(data, size);
+			} else {
+				t = value_type(data, size);
+			}
+		} else if constexpr (traits::is_optional_v<value_type>) {
+			if (readRaw<std::uint8_t>() == 0) {
+				t.reset();
+				return;
+			}
+			if (not t) {
+				t.emplace();
+			}
+			(*this) % *t;
+		} else if constexpr (traits::is_variant_v<value_type>) {
+			auto index = readRaw<std::uint32_t>();
+			serializer::detail::emplaceAlternative(t, index, std::make_index_sequence<std::variant_size_v<value_type>>{});
+			std::visit([&](auto& v) { (*this) % v; }, t);
+		} else if constexpr (traits::is_tuple_v<value_type>) {
+			std::apply([&](auto&... members) { (((*this) % members), ...); }, t);
+		} else if constexpr (traits::is_map_v<value_type>) {
+			auto count = readElementCount();
+			serializer::detail::MapInserter<value_type> inserter{t, serializer::detail::isUpdating(*this)};
+			if constexpr (traits::has_reserve_v<value_type>) {
+				t.reserve(std::min(count, remaining()));
+			}
+			// the key is needed before the node exists, the value is decoded into the node
+			typename value_type::key_type key;
+			for (std::size_t i{0}; i < count; ++i) {
+				(*this) % key;
+				(*this) % inserter(key);
+			}
+		} else if constexpr (detail::is_flat_vector<value_type>::value) {
+			// the elements are copied as a block, existing capacity is reused
+			using elem_type = typename value_type::value_type;
+			auto count = readCount();
+			if (count > remaining() / sizeof(elem_type)) {
+				throw std::runtime_error("invalid binary stream! it ends in the middle of a sequence");
+			}
+			t.resize(count);
+			if (count) {
+				std::memcpy(t.data(), take(count * sizeof(elem_type)), count * sizeof(elem_type));
+			}
+		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
+			t.serialize(*this);
+		} else {
+			// last resort is using a converter
+			Converter<value_type> converter;
+			converter.deserialize(*this, t);
+		}
+	}
+
+	// calls cb with a Deserializer of every sequence element in order
+	template<typename ElemCb, typename CountCB=int>
+	void deserializeElements(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		auto count = readElementCount();
+		if constexpr (std::is_invocable_v<CountCB, std::size_t>) {
+			// a corrupted count must not reserve more than the stream can hold
+			countCB(std::min(count, remaining()));
+		}
+		for (std::size_t i{0}; i < count; ++i) {
+			Deserializer elem{document, false};
+			cb(elem);
+		}
+	}
+
+	template<typename T, typename ElemCb, typename CountCB=int>
+	void deserializeSequence(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		static_assert(std::is_default_constructible_v<T>);
+		deserializeElements([&](Deserializer& elem) {
+			std::remove_cv_t<T> t;
+			elem % t;
+			cb(std::move(t));
+		}, std::forward<CountCB>(countCB));
+	}
+};
+
+}
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "serializer/Context.h"
+#include "serializer/Converter.h"
+#include "serializer/instrumentation.h"
+#include "serializer/traits.h"
+
+#include "format.h"
+
+namespace serializer {
+namespace binary {
+
+using Buffer = std::vector<std::byte>;
+
+namespace detail {
+
+// state of one serialized document, owned by the root and shared with all children
+struct SerializerDocument {
+	Context context;
+	Buffer buffer;
+};
+
+struct WrittenSince {
+	Buffer const& buffer;
+	std::size_t start;
+	std::size_t operator()() const {
+		return buffer.size() - start;
+	}
+};
+
+}
+
+// Positional binary format for peers that are built from the same types. Names are ignored,
+// values are written in the order they are serialized and have to be read in the same order.
+// Scalars take their size in memory in host byte order, strings and sequences are preceded by
+// their length and sequences of scalars are copied as a block. Every value written at the root
+// level is preceded by the fingerprint of its type, readers with a different layout reject it.
+// Optionals, variants, tuples and maps are written by the backend itself, converters that
+// write positional elements (serializeElement, serializeEntry) are not supported.
+struct Serializer : traits::SerializerTraits<false> {
+private:
+	std::shared_ptr<detail::SerializerDocument> rootDocument;
+	detail::SerializerDocument* document;
+	bool topLevel{false};
+
+	Serializer(detail::SerializerDocument* _document, bool _topLevel)
+		: document{_document}, topLevel{_topLevel} {}
+
+	void writeBytes(void const* data, std::size_t size) {
+		auto& buffer = document->buffer;
+		auto pos = buffer.size();
+		buffer.resize(pos + size);
+		if (size) {
+			std::memcpy(buffer.data() + pos, data, size);
+		}
+	}
+
+	template<typename T>
+	void writeRaw(T const& value) {
+		writeBytes(&value, sizeof(value));
+	}
+
+	// readers refuse more empty elements than detail::maxEmptyElements
+	void checkElements(std::uint64_t count, std::size_t start) const {
+		if (count > detail::maxEmptyElements and document->buffer.size() - start < count) {
+			throw std::runtime_error("cannot serialize more than " + std::to_string(detail::maxEmptyElements) + " elements without content");
+		}
+	}
+
+public:
+	Serializer()
+		: rootDocument{std::make_shared<detail::SerializerDocument>()}
+		, document{rootDocument.get()}
+		, topLevel{true}
+	{
+		writeRaw(detail::magic);
+	}
+
+	Serializer operator[](std::string_view) {
+		return {document, topLevel};
+	}
+
+	auto getBuffer() const -> Buffer const& { return document->buffer; }
+
+	Context& getContext() { return document->context; }
+
+	template<typename T>
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		if (topLevel) {
+			if constexpr (detail::is_wrapper_v<value_type>) {
+				Converter<value_type>{}.serialize(*this, t);
+			} else {
+				writeRaw(detail::fingerprint<value_type>());
+				Serializer{document, false} % t;
+			}
+			return;
+		}
+		SERIALIZER_INSTRUMENT(value_type, Direction::Serialize, (detail::WrittenSince{document->buffer, document->buffer.size()}));
+
+		if constexpr (std::is_same_v<value_type, bool>) {
+			writeRaw(static_cast<std::uint8_t>(t));
+		} else if constexpr (std::is_arithmetic_v<value_type> or std::is_enum_v<value_type>) {
+			writeRaw(t);
+		} else if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
+			detail::writeCount(document->buffer, t.size());
+			writeBytes(t.data(), t.size());
+		} else if constexpr (traits::is_optional_v<value_type>) {
+			writeRaw(static_cast<std::uint8_t>(t.has_value()));
+			if (t) {
+				(*this) % *t;
+			}
+		} else if constexpr (traits::is_variant_v<value_type>) {
+			if (t.valueless_by_exception()) {
+				throw std::runtime_error("cannot serialize a valueless variant");
+			}
+			writeRaw(static_cast<std::uint32_t>(t.index()));
+			std::visit([&](auto& v) { (*this) % v; }, t);
+		} else if constexpr (traits::is_tuple_v<value_type>) {
+			std::apply([&](auto&... members) { (((*this) % members), ...); }, t);
+		} else if constexpr (traits::is_map_v<value_type>) {
+			detail::writeCount(document->buffer, t.size());
+			auto start = document->buffer.size();
+			for (auto& [key, value] : t) {
+				(*this) % key;
+				(*this) % value;
+			}
+			checkElements(t.size(), start);
+		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
+			t.serialize(*this);
+		} else {
+			// last resort is using a converter
+			Converter<value_type> converter;
+			converter.serialize(*this, t);
+		}
+	}
+
+	template<typename IterT>
+	void serializeSequence(IterT begin, IterT end) {
+		using elem_type = std::remove_cv_t<typename std::iterator_traits<IterT>::value_type>;
+		auto count = static_cast<std::uint64_t>(std::distance(begin, end));
+		detail::writeCount(document->buffer, count);
+		if constexpr (std::contiguous_iterator<IterT> and detail::is_flat_v<elem_type>) {
+			writeBytes(std::to_address(begin), static_cast<std::size_t>(end - begin) * sizeof(elem_type));
+		} else {
+			auto start = document->buffer.size();
+			for (; begin != end; std::advance(begin, 1)) {
+				Serializer{document, false} % *begin;
+			}
+			checkElements(count, start);
+		}
+	}
+};
+
+}
+}
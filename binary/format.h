@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "serializer/Cached.h"
+#include "serializer/Columnar.h"
+#include "serializer/Compression.h"
+#include "serializer/IndexedMap.h"
+#include "serializer/IntegerEncoding.h"
+#include "serializer/Schema.h"
+#include "serializer/Update.h"
+#include "serializer/demangle.h"
+
+namespace serializer::binary::detail
+{
+
+// first bytes of every document, written in host byte order
+inline constexpr std::uint32_t magic        = 0x4E494253; // "SBIN" on little endian hosts
+inline constexpr std::uint32_t swappedMagic = 0x5342494E;
+
+// scalars whose bytes can be copied as a block, bool is excluded since not every byte is a valid bool
+template<typename T>
+inline constexpr bool is_flat_v = (std::is_arithmetic_v<T> and not std::is_same_v<T, bool>) or std::is_enum_v<T>;
+
+// wrappers whose converters pass their value on, a fingerprint belongs to the wrapped value
+template<typename T>
+struct is_wrapper : std::false_type {};
+template<typename T>
+struct is_wrapper<Update<T>> : std::true_type {};
+template<typename T>
+struct is_wrapper<Compressed<T>> : std::true_type {};
+template<typename T>
+struct is_wrapper<PackedIntegers<T>> : std::true_type {};
+template<typename T>
+struct is_wrapper<IndexedMap<T>> : std::true_type {};
+template<typename T>
+struct is_wrapper<Columnar<T>> : std::true_type {};
+template<typename T>
+struct is_wrapper<Cached<T>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_wrapper_v = is_wrapper<T>::value;
+
+// counts and string lengths are LEB128 encoded
+inline void writeCount(std::vector<std::byte>& out, std::uint64_t value) {
+	while (value >= 0x80) {
+		out.emplace_back(std::byte(value | 0x80));
+		value >>= 7;
+	}
+	out.emplace_back(std::byte(value));
+}
+
+// every element of a sequence or map takes at least one byte, except those of types without content (empty
+// structs, std::monostate); the stream cannot bound their number, at most this many of them are written and read
+inline constexpr std::uint64_t maxEmptyElements = 1 << 20;
+
+inline std::uint64_t readCount(std::byte const*& b, std::byte const* end) {
+	std::uint64_t value{0};
+	for (unsigned shift{0}; shift < 64; shift += 7) {
+		if (b == end) {
+			throw std::runtime_error("binary stream ends in the middle of a count");
+		}
+		auto byte = std::to_integer<std::uint64_t>(*b++);
+		value |= (byte & 0x7f) << shift;
+		if (not (byte & 0x80)) {
+			return value;
+		}
+	}
+	throw std::runtime_error("invalid binary stream! count of more than 64 bits");
+}
+
+// FNV-1a over everything that decides the layout of a schema
+struct Fingerprint {
+	std::uint64_t hash{14695981039346656037ULL};
+
+	void add(std::uint64_t value) {
+		for (int i{0}; i < 8; ++i) {
+			hash ^= (value >> (8*i)) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	void add(std::string_view text) {
+		add(std::uint64_t{text.size()});
+		for (auto c : text) {
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	void add(Schema const& schema) {
+		add(static_cast<std::uint64_t>(schema.kind));
+		add(std::uint64_t{schema.width});
+		add(std::string_view{schema.name});
+		add(std::uint64_t{schema.children.size()});
+		for (auto const& child : schema.children) {
+			add(child);
+		}
+	}
+};
+
+// identifies the layout T is written with, values written with another layout are rejected.
+// Types without a finite schema (pointers, recursive types) are only identified by their name.
+template<typename T>
+std::uint64_t fingerprint() {
+	static std::uint64_t const value = [] {
+		Fingerprint f;
+		if constexpr (std::is_default_constructible_v<T>) {
+			try {
+				f.add(makeSchema<T>());
+				return f.hash;
+			} catch (std::invalid_argument const&) {}
+		}
+		f.add(std::string_view{demangle<T>()});
+		return f.hash;
+	}();
+	return value;
+}
+
+}
@@ -2,12 +2,29 @@
 
 #include <type_traits>
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include "serializer/Columnar.h"
+#include "serializer/Compression.h"
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/IntegerEncoding.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
+#include "columns.h"
+#include "compression.h"
+#include "crc32c.h"
 #include "hasher.h"
+#include "ids.h"
+#include "packing.h"
 #include "varint.h"
 
 namespace serializer {
@@ -16,19 +33,76 @@ namespace ebml {
 namespace detail
 {
 
-template<typename Hasher>
+// state of one deserialized document, shared by all Deserializers of that document
+struct DeserializerDocument {
+	Context context;
+	serializer::detail::UpdateMode updateMode;
+	std::size_t bufferSize{0};
+	bool stringDictionary{false};
+	// views into the buffer indexed by their dictionary index, read from the string tables at the root level,
+	// shared with the cursors of a Document
+	std::shared_ptr<std::vector<std::string_view> const> strings;
+	bool fieldDictionary{false};
+	// views into the buffer, read from the field name tables at the root level, shared with the cursors of a Document
+	std::shared_ptr<std::unordered_map<std::string_view, std::uint64_t> const> fieldIds;
+	// elements may start with a CRC-32 element over their content
+	bool checksums{false};
+	// the document is a patch written by diff(), see diff.h
+	bool patch{false};
+	// the CRC-32C of the document the patch was written against
+	std::optional<std::uint32_t> patchBase;
+	// decompressed elements, Deserializers and string_views point into them
+	std::vector<std::vector<std::byte>> buffers;
+};
+
+// Checked=false trusts the framing of documents that passed validate(), see validate.h. Children are found by a
+// flat scan from behind the child found last instead of an index, without bounds checks, and integer sizes and
+// checksums are not verified. The Deserializers of its elements do not share the ownership of the document, they
+// must not outlive the root. Decompressed content was not validated and is read with all checks.
+template<typename Hasher, bool Checked=true>
 struct Deserializer : traits::SerializerTraits<true> {
 	using size_t = std::make_signed_t<std::size_t>;
 private:
+	using DocumentPtr = std::conditional_t<Checked, std::shared_ptr<DeserializerDocument>, DeserializerDocument*>;
+	struct NoOwner {};
 
 	std::byte const* buffer;
 	size_t size;
 	std::size_t autoIdLen{4};
+	DocumentPtr document;
+	// the root of the unchecked variant owns the document
+	[[no_unique_address]] std::conditional_t<Checked, NoOwner, std::shared_ptr<DeserializerDocument>> owner;
+	// the content was covered by the checksum of this element or of one of its ancestors
+	bool verified{false};
+	// the element is patched: missing children keep their values unless they are listed as removed
+	bool patching{false};
+	// the unchecked variant skips the checks that validate() did for this content
+	bool trusted{not Checked};
+	// the unchecked variant looks for children from here on first
+	std::byte const* next{nullptr};
+
+	// size of missing children of patched elements
+	static constexpr size_t kept{-2};
 
-	Deserializer(std::byte const* _buffer, size_t _size, std::size_t _autoIdLen)
-		: buffer{_buffer}, size{_size}, autoIdLen{_autoIdLen}
+	Deserializer(std::byte const* _buffer, size_t _size, std::size_t _autoIdLen, DocumentPtr const& _document)
+		: buffer{_buffer}, size{_size}, autoIdLen{_autoIdLen}, document{_document}
 	{}
 
+	static DocumentPtr share(std::shared_ptr<DeserializerDocument> const& document) {
+		if constexpr (Checked) {
+			return document;
+		} else {
+			return document.get();
+		}
+	}
+
+	bool checked() const {
+		return Checked or not trusted;
+	}
+
+	template<typename, bool>
+	friend class Document;
+
 	using ChildInfo = std::pair<Varint, Deserializer>;
 	std::optional<std::vector<ChildInfo>> childElements;
 
@@ -42,26 +116,307 @@ private:
         return vint;
     }
 
+	// calls cb with the id of the child element at b and a Deserializer of its content, b is moved behind it
+	template<typename Cb>
+	void readChild(std::byte const*& b, std::byte const* endB, Cb&& cb) const {
+		auto childID = checked() ? Varint(b, endB-b) : Varint(b, Unchecked{});
+        b += childID.size();
+        if (checked() and b >= endB) {
+            throw std::runtime_error("invalid ebml stream");
+        }
+		auto contentLen = checked() ? VarLen(b, endB-b) : VarLen(b, Unchecked{});
+        b += contentLen.size();
+        if (checked() and (b > endB or static_cast<std::size_t>(endB-b) < contentLen.value())) {
+            throw std::runtime_error("invalid ebml stream");
+        }
+		auto content = b;
+		b += contentLen;
+		Deserializer child(content, static_cast<size_t>(contentLen.value()), autoIdLen, document);
+		child.trusted = trusted;
+		cb(childID, std::move(child));
+	}
+
+	// an element written compressed is read from its decompressed content, which the document keeps
+	void decompress() {
+		if (detail::compressedContent(buffer, buffer + size)) {
+			auto& raw = document->buffers.emplace_back(detail::decompressElement(buffer, buffer + size));
+			buffer  = raw.data();
+			size    = static_cast<size_t>(raw.size());
+			trusted = false;
+		}
+	}
+
+	// the child with id of the unchecked variant, found without storing the children. They are mostly read in
+	// the order they were written, the scan starts behind the child found last
+	Deserializer findChild(Varint const& id) {
+		if (not next) {
+			decompress();
+			next = buffer;
+		}
+		Deserializer found(buffer, -1, autoIdLen, document);
+		if (document->checksums and id == ids::crc32) {
+			return found;
+		}
+		auto scan = [&](std::byte const* b, std::byte const* end) {
+			auto done = false;
+			while (b < end and not done) {
+				readChild(b, buffer + size, [&](Varint const& childId, Deserializer&& child) {
+					if (childId == id) {
+						found = std::move(child);
+						done  = true;
+					}
+				});
+			}
+			if (done) {
+				next = b;
+			}
+			return done;
+		};
+		if (not scan(next, buffer + size)) {
+			scan(buffer, next);
+		}
+		return found;
+	}
+
 	void populateChildren() {
 		if (not childElements) {
+			decompress();
 			std::vector<ChildInfo> children;
 			auto b = buffer;
 			auto endB = buffer + size;
 			while (b < endB) {
-				auto childID = Varint(b, endB-b);
-                b += childID.size();
-                if (b >= endB) {
-                    throw std::runtime_error("invalid ebml stream");
-                }
-				auto contentLen = VarLen(b, endB-b);
-                b += contentLen.size();
-                if (b > endB or static_cast<std::size_t>(endB-b) < contentLen.value()) {
-                    throw std::runtime_error("invalid ebml stream");
-                }
-				children.emplace_back(childID, Deserializer(b, contentLen, autoIdLen));
-				b += contentLen;
+				readChild(b, endB, [&](Varint const& id, Deserializer&& child) {
+					children.emplace_back(id, std::move(child));
+				});
+			}
+			// the CRC-32 elements stay among the children, each block is verified when one of its
+			// children is read the first time
+			auto hasChecksums = document->checksums and not children.empty() and children.front().first == ids::crc32;
+			for (auto& child : children) {
+				child.second.verified = verified;
+				if (hasChecksums and checked() and child.first == ids::crc32) {
+					checkCrcElement(child.second);
+				}
 			}
 			childElements = std::move(children);
+			if (document->patch) {
+				auto first = std::find_if(childElements->begin(), childElements->end(), [](auto const& c) { return c.first != ids::crc32; });
+				if (first != childElements->end() and first->first == ids::patchMarker) {
+					verifyBlockOf(first);
+					childElements->erase(first);
+					patching = true;
+				}
+			}
+		}
+	}
+
+	// a CRC-32 element of 4 bytes behind an id and size of one byte each, the next block starts behind it
+	static void checkCrcElement(Deserializer const& crc) {
+		if (crc.size != 4 or crc.buffer[-2] != std::byte{0xBF} or crc.buffer[-1] != std::byte{0x84}) {
+			throw std::runtime_error("invalid ebml stream! crc-32 elements have 4 bytes");
+		}
+	}
+
+	// verifies the block that starts with the CRC-32 element crc unless that happened already,
+	// the children of the block are verified unless they carry checksums themselves
+	void verifyBlock(typename std::vector<ChildInfo>::iterator crc) {
+		auto& checksum = crc->second;
+		if (checksum.verified) {
+			return;
+		}
+		auto next = std::find_if(crc + 1, childElements->end(), [](auto const& c) { return c.first == ids::crc32; });
+		auto end  = next == childElements->end() ? buffer + size : next->second.buffer - 2;
+		auto only = next - crc == 2 ? &crc[1].second : nullptr;
+		auto result = detail::checkBlock(readChecksum(checksum.buffer), checksum.buffer + checksum.size, end,
+				only ? only->buffer : nullptr, only ? static_cast<std::size_t>(only->size) : 0);
+		if (result == detail::BlockCheck::Corrupted) {
+			throw std::runtime_error("invalid ebml stream! checksum mismatch, the element is corrupted");
+		}
+		for (auto it = crc + 1; it != next; ++it) {
+			it->second.verified = result == detail::BlockCheck::Covered;
+		}
+		checksum.verified = true;
+	}
+
+	// verifies the block of the child it before it is read
+	void verifyBlockOf(typename std::vector<ChildInfo>::iterator it) {
+		if (it->second.verified or not checked() or not document->checksums or childElements->front().first != ids::crc32) {
+			return;
+		}
+		while (it->first != ids::crc32) {
+			--it;
+		}
+		verifyBlock(it);
+	}
+
+	// verifies the blocks of all children that were not verified yet
+	void verifyBlocks() {
+		if (verified or not checked() or not document->checksums) {
+			return;
+		}
+		for (auto it = childElements->begin(); it != childElements->end(); ++it) {
+			if (it->first == ids::crc32) {
+				verifyBlock(it);
+			}
+		}
+	}
+
+	// true if id is listed in the removedFields child of a patched element
+	bool isRemoved(Varint const& id) {
+		for (auto it = childElements->begin(); it != childElements->end(); ++it) {
+			if (it->first != ids::removedFields) {
+				continue;
+			}
+			verifyBlockOf(it);
+			auto const& child = it->second;
+			for (auto b = child.buffer, endB = child.buffer + child.size; b < endB;) {
+				auto removed = Varint(b, static_cast<std::size_t>(endB - b));
+				b += removed.size();
+				if (removed.value() == id.value()) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// entries of a patched map replace or add the entry with their key, removedEntry elements erase it
+	template<typename Map>
+	void patchEntries(Map& map) {
+		verifyBlocks();
+		for (auto& [id, child] : *childElements) {
+			if (id != ids::sequenceElement and id != ids::removedEntry) {
+				continue;
+			}
+			typename Map::key_type key{};
+			child["first"] % key;
+			if (id == ids::removedEntry) {
+				map.erase(key);
+			} else {
+				child["second"] % map[key];
+			}
+		}
+	}
+
+	// scatters the columns of a columnar sequence back into the records, in update mode the existing
+	// records are decoded into
+	template<typename Container>
+	void readColumns(Container& records) {
+		using record_type = typename Container::value_type;
+		std::uint64_t rows{0};
+		(*this)[ids::rowCount] % rows;
+		auto lookup = [this](std::string_view name) {
+			auto column = (*this)[name];
+			return std::pair{column.buffer, std::ptrdiff_t{column.size}};
+		};
+		detail::ColumnReader<decltype(lookup)> reader{document->context, lookup, rows};
+		static_assert(traits::has_serialize_function_v<record_type, decltype(reader)>, "records of columnar sequences need a serialize function");
+		if (not serializer::detail::isUpdating(*this)) {
+			records.clear();
+		}
+		// a corrupted count fails with the first column, which has to hold a value for every record.
+		// Without any column the records hold no bytes of the stream, their count is bounded by its size
+		for (std::uint64_t row{0}; row < rows; ++row) {
+			if (row == records.size()) {
+				records.emplace_back();
+			}
+			reader.beginRow(row);
+			records[row].serialize(reader);
+			if (row == 0 and not reader.hasColumns() and rows > document->bufferSize) {
+				throw std::runtime_error("invalid ebml stream! more records than the stream can hold");
+			}
+		}
+		records.erase(records.begin() + static_cast<std::ptrdiff_t>(rows), records.end());
+	}
+
+	std::string_view readString() const {
+		if (not document->stringDictionary) {
+			return std::string_view(reinterpret_cast<const char*>(buffer), static_cast<std::size_t>(size));
+		}
+		if (size == 0) {
+			throw std::runtime_error("invalid ebml stream! string without dictionary index");
+		}
+		auto index = Varint(buffer, size).value();
+		auto const& strings = *document->strings;
+		if (index >= strings.size()) {
+			throw std::runtime_error("invalid ebml stream! string dictionary index out of range");
+		}
+		return strings[index];
+	}
+
+	// the content of the element, wrappers like compressed() read the content of their value
+	template<typename T>
+	void readContent(T& t) {
+		using value_type = std::remove_cv_t<T>;
+		if constexpr (std::is_same_v<value_type, std::string>) {
+			auto view = readString();
+			t.assign(view.data(), view.size());
+		} else if constexpr (std::is_same_v<value_type, std::string_view>) {
+			// points into the deserialized buffer, with a string dictionary all equal strings share their bytes
+			t = readString();
+		} else if constexpr (std::is_integral_v<value_type>) {
+			if (checked() and size > 8) {
+				throw std::runtime_error("invalid ebml stream! integer elements have at most 8 bytes");
+			}
+			auto bits = detail::readBigEndian(buffer, static_cast<std::size_t>(size));
+			if constexpr (not std::is_unsigned_v<value_type>) {
+				// sign extension of the shorter encoding
+				if (size and size < 8) {
+					auto shift = 64 - 8*size;
+					bits = static_cast<std::uint64_t>(static_cast<std::int64_t>(bits << shift) >> shift);
+				}
+			}
+			t = static_cast<value_type>(bits);
+		} else if constexpr (std::is_floating_point_v<value_type>) {
+			auto bits = size <= 8 ? detail::readBigEndian(buffer, static_cast<std::size_t>(size)) : 0;
+			if (size == 4) {
+				auto bits32 = static_cast<std::uint32_t>(bits);
+				float value;
+				std::memcpy(&value, &bits32, sizeof(value));
+				t = value;
+			} else if (size == 8) {
+				double value;
+				std::memcpy(&value, &bits, sizeof(value));
+				t = static_cast<value_type>(value);
+			} else if (size == 0) {
+				t = 0;
+			} else {
+				throw std::runtime_error("invalid ebml stream! float elements have 0, 4 or 8 bytes");
+			}
+		} else if constexpr (std::is_enum_v<value_type>) {
+			std::underlying_type_t<value_type> value{};
+			readContent(value);
+			t = static_cast<value_type>(value);
+		} else if constexpr (traits::is_packed_integers_v<value_type>) {
+			using inner_type = typename value_type::container_type::value_type;
+			auto values = detail::decodeIntegers<inner_type>(buffer, buffer + size);
+			t.container.clear();
+			if constexpr (traits::has_reserve_v<typename value_type::container_type>) {
+				t.container.reserve(values.size());
+			}
+			for (auto v : values) {
+				t.container.insert(t.container.end(), static_cast<inner_type>(v));
+			}
+		} else if constexpr (traits::is_columnar_v<value_type>) {
+			readColumns(t.container);
+		} else if constexpr (traits::is_compressed_v<value_type>) {
+			decompress();
+			readContent(t.value);
+		} else if constexpr (traits::is_map_v<value_type>) {
+			if (document->patch) {
+				populateChildren();
+			}
+			if (patching) {
+				patchEntries(t);
+			} else {
+				Converter<value_type>{}.deserialize(*this, t);
+			}
+		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
+			t.serialize(*this);
+		} else {
+			// last resort is using a converter
+			Converter<value_type> converter;
+			converter.deserialize(*this, t);
 		}
 	}
 
@@ -69,40 +424,145 @@ public:
 	Deserializer(std::byte const* _buffer, std::size_t _size)
 		: buffer{_buffer}, size{static_cast<size_t>(_size)}
 	{
-		// read the header
-		auto headerDeser = (*this)[0x0A45DFA3];
+		if constexpr (Checked) {
+			document = std::make_shared<DeserializerDocument>();
+		} else {
+			owner    = std::make_shared<DeserializerDocument>();
+			document = owner.get();
+		}
+		document->bufferSize = _size;
+		// read the header, the root level is split once for the tables of the dictionaries
+		populateChildren();
+		auto headerDeser = (*this)[ids::header];
 		if (headerDeser.size == -1) {
 			throw std::runtime_error("cannot deserialize stream! there is no header information");
 		}
-		headerDeser[0x02f2] % autoIdLen; // maximum id-length
+		headerDeser[ids::maxIdLength] % autoIdLen; // maximum id-length
+		if (autoIdLen == 0 or autoIdLen > 8) {
+			throw std::runtime_error("cannot deserialize stream! maximum id length out of range");
+		}
 		std::string contentType;
-		headerDeser[0x0282] % contentType;
+		headerDeser[ids::docType] % contentType;
 		if (contentType != "ebml-serializer") {
 			throw std::runtime_error("cannot deserialize stream! wrong document type");
 		}
+		int stringDictionary{0};
+		headerDeser[ids::stringDictionary] % stringDictionary;
+		document->stringDictionary = stringDictionary != 0;
+		int fieldDictionary{0};
+		headerDeser[ids::fieldDictionary] % fieldDictionary;
+		document->fieldDictionary = fieldDictionary != 0;
+		int checksums{0};
+		headerDeser[ids::checksums] % checksums;
+		document->checksums = checksums != 0;
+		int patch{0};
+		headerDeser[ids::patch] % patch;
+		document->patch = patch != 0;
+		if (document->patch) {
+			headerDeser[ids::patchBase] % document->patchBase;
+			// a patch is decoded into the existing values, its root level is patched
+			document->updateMode.enabled = true;
+			patching = true;
+		}
+		if (document->fieldDictionary) {
+			auto fieldIds = std::make_shared<std::unordered_map<std::string_view, std::uint64_t>>();
+			// the tables follow the root elements that introduced their names, all of them are read in one pass
+			auto isTable = [](auto const& c) { return c.first == ids::fieldNames; };
+			for (auto& child : *childElements) {
+				if (not isTable(child)) {
+					continue;
+				}
+				auto& table = child.second;
+				table.populateChildren();
+				for (auto const& [id, entry] : *table.childElements) {
+					if (id == ids::absentElement) {
+						continue;
+					}
+					auto name = std::string_view(reinterpret_cast<const char*>(entry.buffer), static_cast<std::size_t>(entry.size));
+					fieldIds->emplace(name, id.value());
+				}
+			}
+			childElements->erase(std::remove_if(begin(*childElements), end(*childElements), isTable), end(*childElements));
+			document->fieldIds = std::move(fieldIds);
+		}
+		if (document->stringDictionary) {
+			// every string is read from the tables, the elements that hold it can be read in any order
+			auto strings = std::make_shared<std::vector<std::string_view>>();
+			auto isTable = [](auto const& c) { return c.first == ids::strings; };
+			for (auto& child : *childElements) {
+				if (not isTable(child)) {
+					continue;
+				}
+				auto& table = child.second;
+				table.populateChildren();
+				for (auto const& [id, entry] : *table.childElements) {
+					if (id == ids::sequenceElement) {
+						strings->emplace_back(reinterpret_cast<const char*>(entry.buffer), static_cast<std::size_t>(entry.size));
+					}
+				}
+			}
+			childElements->erase(std::remove_if(begin(*childElements), end(*childElements), isTable), end(*childElements));
+			document->strings = std::move(strings);
+		}
 		for (auto& child : *childElements) {
 			child.second.autoIdLen = autoIdLen;
 		}
 	}
 
+	Context& getContext() {
+		return document->context;
+	}
+
+	serializer::detail::UpdateMode& getUpdateMode() {
+		return document->updateMode;
+	}
+
+	// the CRC-32C of the document a patch was written against, if the patch names it
+	std::optional<std::uint32_t> getPatchBase() const {
+		return document->patchBase;
+	}
+
+	// false if the element is missing or was omitted
+	bool present() const {
+		return size >= 0;
+	}
+
 	Deserializer operator[](std::uint64_t id) {
 		return (*this)[Varint{id}];
 	}
 
 	Deserializer operator[](std::string_view const& name) {
+		if (document->fieldDictionary) {
+			auto it = document->fieldIds->find(name);
+			if (it == document->fieldIds->end()) {
+				return Deserializer(buffer, -1, autoIdLen, document);
+			}
+			return (*this)[Varint{it->second}];
+		}
 		return (*this)[genID<Hasher>(name, autoIdLen)];
 	}
 
 	Deserializer operator[](Varint const& id) {
+		if constexpr (not Checked) {
+			if (not document->patch) {
+				return findChild(id);
+			}
+		}
 		populateChildren();
+		if (document->checksums and id == ids::crc32) {
+			return Deserializer(buffer, -1, autoIdLen, document);
+		}
 		auto it = std::find_if(childElements->begin(), childElements->end(),
-				[&](auto c)
+				[&](auto const& c)
 				{ return c.first == id; }
 		);
 
 		if (it == childElements->end()) {
-			return Deserializer(buffer, -1, autoIdLen);
+			// the child may be missing because its id is corrupted
+			verifyBlocks();
+			return Deserializer(buffer, patching and not isRemoved(id) ? kept : -1, autoIdLen, document);
 		}
+		verifyBlockOf(it);
 		Deserializer ret = it->second;
 		childElements->erase(it);
 		return ret;
@@ -110,59 +570,193 @@ public:
 
 
 	template<typename T>
-	void operator%(T& t) {
-		using value_type = std::remove_cv_t<T>;
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		SERIALIZER_INSTRUMENT(value_type, Direction::Deserialize, [&] { return size < 0 ? 0 : size; });
 		if (size < 0) {
+			// missing elements keep the value, only optionals and pointers learn about their absence unless a patch
+			// keeps them
+			if constexpr (traits::is_nullable_v<value_type>) {
+				if (size != kept) {
+					t.reset();
+				}
+			}
 			return;
 		}
-		if constexpr (std::is_same_v<value_type, std::string>) {
-			t = value_type(reinterpret_cast<const char*>(buffer), static_cast<std::size_t>(size));
-		} else if constexpr (std::is_integral_v<value_type>) {
-			t = 0;
-            for (auto i{0U}; i < size; ++i) {
-                t = (t << 8) | static_cast<value_type>(buffer[i]);
-            }
-            if constexpr (not std::is_unsigned_v<value_type>) {
-                if (size and (buffer[0] & std::byte{0x80}) != std::byte{0x00}) {
-                    t |= ~((1 << (8*size)) - 1);
-                }
-            }
-		} else if constexpr (std::is_enum_v<value_type>) {
-			(*this) % static_cast<std::underlying_type_t<value_type>>(t);
-		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
-			t.serialize(*this);
-		} else {
-			// last resort is using a converter
-			Converter<value_type> converter;
-			converter.deserialize(*this, t);
+		// elements written compressed are read with and without compressed()
+		if constexpr (not traits::is_compressed_v<value_type>) {
+			decompress();
 		}
+		readContent(t);
 	}
 
-	template<typename T, typename ElemCb, typename CountCB=int>
-	void deserializeSequence(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+	// finds key in a map written with indexed() by binary search over its index and decodes only the
+	// value of that entry, false if the key or the map is missing. The keys of the probed entries are
+	// decoded into K and compared with operator<. The checksum of the map is not verified since most
+	// of it is not read, entries with checksums of their own are.
+	template<typename K, typename V>
+	bool lookup(K const& key, V& value) {
+		if (size < 0) {
+			return false;
+		}
+		decompress();
+		auto b    = buffer;
+		auto endB = buffer + size;
+		if (b == endB) {
+			throw std::runtime_error("invalid ebml stream! the element is no indexed map");
+		}
+		std::optional<ChildInfo> index;
+		auto readIndex = [&](Varint const& id, Deserializer&& child) { index.emplace(id, std::move(child)); };
+		readChild(b, endB, readIndex);
+		if (document->checksums and index->first == ids::crc32 and b < endB) {
+			readChild(b, endB, readIndex);
+		}
+		auto const& offsets = index->second;
+		if (index->first != ids::mapIndex or (checked() and offsets.size < 1)) {
+			throw std::runtime_error("invalid ebml stream! the element is no indexed map");
+		}
+		auto width = std::to_integer<std::size_t>(offsets.buffer[0]);
+		if (checked() and (width == 0 or width > 8 or (offsets.size - 1) % width != 0)) {
+			throw std::runtime_error("invalid ebml stream! malformed map index");
+		}
+		auto count   = static_cast<std::size_t>(offsets.size - 1) / width;
+		auto entries = b;
+		auto entry = [&](std::size_t i) {
+			auto offset = detail::readBigEndian(offsets.buffer + 1 + i*width, width);
+			if (checked() and offset >= static_cast<std::uint64_t>(endB - entries)) {
+				throw std::runtime_error("invalid ebml stream! map index points behind the map");
+			}
+			auto e = entries + offset;
+			std::optional<Deserializer> found;
+			readChild(e, endB, [&](Varint const& id, Deserializer&& child) {
+				if (checked() and id != ids::sequenceElement) {
+					throw std::runtime_error("invalid ebml stream! map index points to no entry");
+				}
+				child.verified = verified;
+				found.emplace(std::move(child));
+			});
+			return std::move(*found);
+		};
+		std::size_t lo{0};
+		std::size_t hi{count};
+		while (lo < hi) {
+			auto mid = lo + (hi - lo) / 2;
+			K k{};
+			entry(mid)["first"] % k;
+			if (k < key) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo == count) {
+			return false;
+		}
+		auto found = entry(lo);
+		K k{};
+		found["first"] % k;
+		if (key < k) {
+			return false;
+		}
+		found["second"] % value;
+		return true;
+	}
+
+	// calls cb with a Deserializer of every sequence element in order, the converter decodes
+	// each element directly into its final place. Patched sequences hold runs of elements that keep
+	// their value as keptElements with their count.
+	template<typename ElemCb, typename CountCB=int>
+	void deserializeElements(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		if constexpr (not Checked) {
+			if (not document->patch) {
+				deserializeElementsFlat(cb, countCB);
+				return;
+			}
+		}
 		populateChildren();
-		Varint targetId{0x01};
+		verifyBlocks();
+		auto isKept    = [&](auto const& c) { return patching and c.first == ids::keptElements; };
+		auto isElement = [&](auto const& c) { return c.first == ids::sequenceElement or c.first == ids::absentElement or isKept(c); };
+		auto keptCount = [](Deserializer run) {
+			std::uint64_t count{0};
+			run % count;
+			return count;
+		};
+		if constexpr (not std::is_same_v<CountCB, int>) {
+			std::uint64_t count{0};
+			for (auto const& child : *childElements) {
+				count += isKept(child) ? keptCount(child.second) : isElement(child);
+			}
+			// only a hint, a corrupted count must not reserve more than the stream can hold
+			countCB(static_cast<std::size_t>(std::min<std::uint64_t>(count, document->bufferSize)));
+		}
+		for (auto& child : *childElements) {
+			if (isKept(child)) {
+				Deserializer keep(buffer, kept, autoIdLen, document);
+				for (auto n = keptCount(child.second); n > 0; --n) {
+					cb(keep);
+				}
+			} else if (child.first == ids::absentElement) {
+				// keeps its position but is not present
+				Deserializer absent(child.second.buffer, -1, autoIdLen, document);
+				cb(absent);
+			} else if (isElement(child)) {
+				cb(child.second);
+			}
+		}
+		childElements->erase(std::remove_if(begin(*childElements), end(*childElements), isElement), end(*childElements));
+	}
+
+	// deserializeElements of the unchecked variant, without storing the children
+	template<typename ElemCb, typename CountCB>
+	void deserializeElementsFlat(ElemCb& cb, CountCB& countCB) {
+		auto forChildren = [&](auto&& childCb) {
+			for (auto b = buffer, endB = buffer + size; b < endB;) {
+				readChild(b, endB, childCb);
+			}
+		};
 		if constexpr (not std::is_same_v<CountCB, int>) {
-			auto count = std::count_if(begin(*childElements), end(*childElements), [&](auto c) {return c.first == targetId; });
-			countCB(count);
+			std::size_t count{0};
+			forChildren([&](Varint const& id, Deserializer&&) {
+				count += id == ids::sequenceElement or id == ids::absentElement;
+			});
+			countCB(std::min<std::size_t>(count, document->bufferSize));
 		}
-		while (true) {
-			auto subSer = (*this)[targetId];
-			if (subSer.size == -1) {
-				break;
+		forChildren([&](Varint const& id, Deserializer&& child) {
+			if (id == ids::absentElement) {
+				// keeps its position but is not present
+				child.size = -1;
+				cb(child);
+			} else if (id == ids::sequenceElement) {
+				cb(child);
 			}
+		});
+	}
+
+	// calls cb with a Deserializer of the key and of the value of every map entry
+	template<typename EntryCb, typename CountCB=int>
+	void deserializeEntries(EntryCb&& cb, CountCB&& countCB=CountCB{}) {
+		deserializeElements([&](Deserializer& elem) {
+			auto key   = elem["first"];
+			auto value = elem["second"];
+			cb(key, value);
+		}, std::forward<CountCB>(countCB));
+	}
+
+	template<typename T, typename ElemCb, typename CountCB=int>
+	void deserializeSequence(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		deserializeElements([&](Deserializer& elem) {
 			T t;
-			subSer % t;
+			elem % t;
 			cb(std::move(t));
-		}
+		}, std::forward<CountCB>(countCB));
 	}
 };
 
 }
 
 using Deserializer = detail::Deserializer<detail::Hash>;
+using UncheckedDeserializer = detail::Deserializer<detail::Hash, false>;
 
 }
 }
-
-
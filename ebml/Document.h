@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Deserializer.h"
+#include "hasher.h"
+#include "ids.h"
+#include "varint.h"
+
+namespace serializer {
+namespace ebml {
+namespace detail {
+
+// A parsed document that is read by many threads at once. The header, the dictionaries and an index of the
+// root level are read once when it is created. Nested elements are indexed once as well, by the first cursor
+// that looks for one of their children, later lookups by any thread only read the index. Every thread reads
+// through its own cursors:
+//     auto snapshot = std::make_shared<ebml::Document const>(buffer.data(), buffer.size());
+//     // on any thread
+//     auto cursor = snapshot->cursor();
+//     cursor["config"]["limits"] % limits;
+// Cursors have the interface of the Deserializer, but finding a child does not consume it. A cursor and the
+// cursors obtained from it share the state of their reads (context, decompressed elements) and belong to one
+// thread. Patches are applied with the Deserializer and are refused. The buffer has to outlive the document
+// and the document its cursors. Checked=false reads documents that passed validate() like the
+// UncheckedDeserializer does.
+template<typename Hasher, bool Checked=true>
+class Document {
+	using Reader = Deserializer<Hasher, Checked>;
+	using size_t = typename Reader::size_t;
+
+	// an element of the document, the index of its children is built once by the first cursor that looks
+	// for one of them and is only read afterwards
+	struct Node {
+		std::byte const* content{nullptr};
+		size_t size{0};
+		bool verified{false};
+		// see Deserializer::trusted, decompressed content was not validated
+		bool trusted{not Checked};
+		mutable std::once_flag indexed;
+		// the first child with each id, the nodes are owned by children
+		mutable std::unordered_map<std::uint64_t, Node const*> index;
+		mutable std::unique_ptr<Node[]> children;
+		// the decompressed content of a compressed element, its children point into it
+		mutable std::vector<std::vector<std::byte>> buffers;
+	};
+
+	std::byte const* buffer;
+	std::size_t bufferSize;
+	std::size_t autoIdLen;
+	// the settings of the header and the dictionaries, each cursor starts its reads with a copy
+	std::shared_ptr<DeserializerDocument const> prototype;
+	Node root;
+
+	void addChildren(Node const& node, std::vector<typename Reader::ChildInfo> const& children) const {
+		auto skip = [&](Varint const& id) { return prototype->checksums and id == ids::crc32; };
+		for (auto const& [id, child] : children) {
+			if (not skip(id)) {
+				node.index.try_emplace(id.value(), nullptr);
+			}
+		}
+		node.children = std::make_unique<Node[]>(node.index.size());
+		std::size_t count{0};
+		for (auto const& [id, child] : children) {
+			if (skip(id)) {
+				continue;
+			}
+			auto& found = node.index[id.value()];
+			if (found) {
+				continue;
+			}
+			auto& n    = node.children[count++];
+			n.content  = child.buffer;
+			n.size     = child.size;
+			n.verified = child.verified;
+			n.trusted  = child.trusted;
+			found = &n;
+		}
+	}
+
+	// the children of node by id. With checksums the blocks of all children are verified when the index is built,
+	// it is built only once
+	std::unordered_map<std::uint64_t, Node const*> const& childrenOf(Node const& node) const {
+		std::call_once(node.indexed, [&] {
+			auto state = std::make_shared<DeserializerDocument>();
+			state->checksums = prototype->checksums;
+			Reader element(node.content, node.size, autoIdLen, Reader::share(state));
+			element.verified = node.verified;
+			element.trusted  = node.trusted;
+			element.populateChildren();
+			element.verifyBlocks();
+			addChildren(node, *element.childElements);
+			node.buffers = std::move(state->buffers);
+		});
+		return node.index;
+	}
+
+public:
+	class Cursor {
+		Document const* document;
+		// the element the cursor is at, nullptr if it is missing
+		Node const* node;
+		std::shared_ptr<DeserializerDocument> state;
+
+		Cursor(Document const* _document, Node const* _node, std::shared_ptr<DeserializerDocument> _state)
+			: document{_document}, node{_node}, state{std::move(_state)}
+		{}
+
+		friend class Document;
+
+		Reader reader() const {
+			Reader r(node ? node->content : document->buffer, node ? node->size : -1, document->autoIdLen, Reader::share(state));
+			r.verified = node and node->verified;
+			r.trusted  = node ? node->trusted : not Checked;
+			return r;
+		}
+
+	public:
+		// false if the element is missing or was omitted
+		bool present() const {
+			return node != nullptr;
+		}
+
+		Context& getContext() const {
+			return state->context;
+		}
+
+		Cursor operator[](std::uint64_t id) const {
+			return (*this)[Varint{id}];
+		}
+
+		Cursor operator[](std::string_view const& name) const {
+			if (state->fieldDictionary) {
+				auto it = state->fieldIds->find(name);
+				if (it == state->fieldIds->end()) {
+					return Cursor(document, nullptr, state);
+				}
+				return (*this)[Varint{it->second}];
+			}
+			return (*this)[genID<Hasher>(name, document->autoIdLen)];
+		}
+
+		// the first child with id, found in the index of the element
+		Cursor operator[](Varint const& id) const {
+			if (not node) {
+				return *this;
+			}
+			auto const& children = document->childrenOf(*node);
+			auto it = children.find(id.value());
+			return Cursor(document, it == children.end() ? nullptr : it->second, state);
+		}
+
+		template<typename T>
+		void operator%(T&& t) const {
+			auto r = reader();
+			r % std::forward<T>(t);
+		}
+
+		// see Deserializer::lookup
+		template<typename K, typename V>
+		bool lookup(K const& key, V& value) const {
+			auto r = reader();
+			return r.lookup(key, value);
+		}
+	};
+
+	Document(std::byte const* _buffer, std::size_t _size)
+		: buffer{_buffer}
+		, bufferSize{_size}
+	{
+		// the Deserializer reads the header and the dictionaries and splits the root level
+		Reader reader(buffer, _size);
+		if (reader.document->patch) {
+			throw std::invalid_argument("patches are applied with a Deserializer");
+		}
+		autoIdLen = reader.autoIdLen;
+		if constexpr (Checked) {
+			prototype = reader.document;
+		} else {
+			prototype = reader.owner;
+		}
+		reader.populateChildren();
+		root.content = buffer;
+		root.size    = static_cast<size_t>(bufferSize);
+		std::call_once(root.indexed, [&] { addChildren(root, *reader.childElements); });
+	}
+
+	Document(Document const&) = delete;
+	Document& operator=(Document const&) = delete;
+
+	// a cursor at the root with its own state, may be called from any thread
+	Cursor cursor() const {
+		auto state = std::make_shared<DeserializerDocument>();
+		state->bufferSize       = prototype->bufferSize;
+		state->stringDictionary = prototype->stringDictionary;
+		state->strings          = prototype->strings;
+		state->fieldDictionary  = prototype->fieldDictionary;
+		state->fieldIds         = prototype->fieldIds;
+		state->checksums        = prototype->checksums;
+		return Cursor(this, &root, std::move(state));
+	}
+};
+
+}
+
+using Document = detail::Document<detail::Hash>;
+using UncheckedDocument = detail::Document<detail::Hash, false>;
+
+}
+}
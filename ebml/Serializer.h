@@ -2,12 +2,32 @@
 
 #include <type_traits>
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "serializer/Cached.h"
+#include "serializer/Columnar.h"
+#include "serializer/Compression.h"
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/IndexedMap.h"
+#include "serializer/IntegerEncoding.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
+#include "columns.h"
+#include "compression.h"
+#include "crc32c.h"
 #include "hasher.h"
+#include "ids.h"
+#include "packing.h"
 #include "varint.h"
 
 namespace serializer {
@@ -15,8 +35,49 @@ namespace ebml {
 
 using Buffer = std::vector<std::byte>;
 
+struct Options {
+	std::size_t autoIdLen{4};
+	// strings only hold an index, tables behind the root elements that use a string first hold its bytes
+	bool stringDictionary{false};
+	// field names get short sequential ids instead of hashed ones, tables behind the root elements that use them name them
+	bool fieldDictionary{false};
+	// elements with children of at least checksumMinSize bytes get CRC-32 elements, one in front of every block
+	// of children that reaches checksumMinSize bytes, the Deserializer verifies a block when it reads from it
+	bool checksums{false};
+	std::size_t checksumMinSize{4096};
+	// the document is a patch, fields it does not hold keep their values when it is read, see diff.h
+	bool patch{false};
+	// the CRC-32C of the document the patch was written against
+	std::optional<std::uint32_t> patchBase{};
+};
+
 namespace detail {
 
+struct StringHash {
+	using is_transparent = void;
+	std::size_t operator()(std::string_view s) const noexcept {
+		return std::hash<std::string_view>{}(s);
+	}
+};
+
+// state of one serialized document, owned by the root and shared with all children
+struct SerializerDocument {
+	Context context;
+	bool stringDictionary{false};
+	std::unordered_map<std::string, std::uint64_t, StringHash, std::equal_to<>> strings;
+	// strings in the order of their index, those from writtenStrings on are not in the buffer yet
+	std::vector<std::string_view> stringList;
+	std::size_t writtenStrings{0};
+	bool fieldDictionary{false};
+	std::unordered_map<std::string, std::uint64_t, StringHash, std::equal_to<>> fieldIds;
+	std::uint64_t nextFieldId{ids::firstFieldId};
+	// ids in the order they were handed out, the names from writtenFieldNames on are not in the buffer yet
+	std::vector<std::pair<std::uint64_t, std::string_view>> fieldNames;
+	std::size_t writtenFieldNames{0};
+	bool checksums{false};
+	std::size_t checksumMinSize{0};
+};
+
 template<typename Hasher>
 struct Serializer: traits::SerializerTraits<false> {
 private:
@@ -24,27 +85,325 @@ private:
 	Serializer* parent {nullptr};
 	std::size_t autoIdLen;
 	std::optional<Varint> id;
+	std::shared_ptr<SerializerDocument> rootDocument;
+	SerializerDocument* document;
+	// the buffer holds child elements, only those get a checksum
+	bool hasChildren{false};
+	// the blocks of children that get a checksum each, header is the length of the id and size of a child
+	// that carries checksums itself, only those are covered
+	struct Block {
+		std::size_t end;
+		std::size_t header;
+	};
+	std::vector<Block> blocks;
 
     template<typename T>
 	void write_raw(T const& t) {
 		std::copy(std::begin(t), std::end(t), std::back_inserter(buffer));
 	}
 
+	Varint fieldId(std::string_view name) {
+		auto& fieldIds = document->fieldIds;
+		if (auto it = fieldIds.find(name); it != fieldIds.end()) {
+			return Varint{it->second};
+		}
+		auto id = document->nextFieldId++;
+		while (ids::isReserved(id)) {
+			id = document->nextFieldId++;
+		}
+		auto it = fieldIds.emplace(std::string{name}, id).first;
+		document->fieldNames.emplace_back(id, it->first);
+		return Varint{id};
+	}
+
+	bool needsChecksum() const {
+		return hasChildren and document->checksums and buffer.size() >= document->checksumMinSize;
+	}
+
+	// called after a child was appended at start, a block ends behind the children that reach the minimum
+	// size and a child with checksums of its own is a block by itself
+	void noteChild(std::size_t start, std::size_t header, bool covered) {
+		if (not document->checksums or not id) {
+			return;
+		}
+		auto blockStart = blocks.empty() ? 0 : blocks.back().end;
+		if (covered) {
+			if (start > blockStart) {
+				blocks.push_back({start, 0});
+			}
+			blocks.push_back({buffer.size(), header});
+		} else if (buffer.size() - blockStart >= document->checksumMinSize) {
+			blocks.push_back({buffer.size(), 0});
+		}
+	}
+
+	// the content with a CRC-32 element in front of every block, the last block ends with the buffer
+	void writeBlocks(Buffer& out) {
+		if (blocks.empty() or blocks.back().end < buffer.size()) {
+			blocks.push_back({buffer.size(), 0});
+		}
+		std::size_t begin{0};
+		for (auto [end, header] : blocks) {
+			writeChecksumElement(out, buffer.data() + begin, header ? header : end - begin);
+			out.insert(out.end(), buffer.begin() + static_cast<std::ptrdiff_t>(begin), buffer.begin() + static_cast<std::ptrdiff_t>(end));
+			begin = end;
+		}
+	}
+
+	std::size_t blockCount() const {
+		return blocks.size() + (blocks.empty() or blocks.back().end < buffer.size());
+	}
+
+	// the entries in key order, preceded by an index element holding the offset of every entry
+	// behind the index: a byte with the width of the offsets and the offsets in big endian
+	template<typename Map>
+	void writeIndexedMap(Map& map) {
+		using key_type = typename Map::key_type;
+		std::vector<typename Map::value_type*> entries;
+		entries.reserve(map.size());
+		for (auto& entry : map) {
+			entries.emplace_back(&entry);
+		}
+		auto less = [](auto const* a, auto const* b) { return std::less<key_type>{}(a->first, b->first); };
+		if (not std::is_sorted(entries.begin(), entries.end(), less)) {
+			std::sort(entries.begin(), entries.end(), less);
+		}
+		std::vector<std::uint64_t> offsets;
+		offsets.reserve(entries.size());
+		for (auto* entry : entries) {
+			offsets.emplace_back(buffer.size());
+			serializeEntry([&](Serializer& key) { key % entry->first; }, [&](Serializer& value) { value % entry->second; });
+		}
+		// with checksums an entry that carries checksums itself is a block of its own, the index then gets one
+		// too, and the offsets count the CRC-32 elements in front of the blocks between the index and the entry
+		std::size_t indexBlock = not blocks.empty() and blocks.front().header;
+		auto indexHead = [&](bool checked) {
+			std::vector<std::uint64_t> positions(offsets);
+			for (std::size_t i{0}, k{0}; checked and i < positions.size(); ++i) {
+				while (k < blocks.size() and blocks[k].end <= offsets[i]) {
+					++k;
+				}
+				positions[i] += checksumElementSize * (k + indexBlock);
+			}
+			// offsets grow, the last one is the largest
+			auto width = std::max<std::size_t>(1, detail::getOctetLength(positions.empty() ? 0 : positions.back()));
+			Buffer index;
+			index.emplace_back(std::byte(width));
+			for (auto offset : positions) {
+				detail::writeBigEndian(index, offset, width);
+			}
+			Buffer head;
+			auto id = Varint{ids::mapIndex};
+			auto len = VarLen{index.size()};
+			std::copy(std::begin(id), std::end(id), std::back_inserter(head));
+			std::copy(std::begin(len), std::end(len), std::back_inserter(head));
+			head.insert(head.end(), index.begin(), index.end());
+			return head;
+		};
+		// the offsets with checksums are larger, so the element keeps its checksums with them
+		auto head = indexHead(false);
+		if (hasChildren and document->checksums and buffer.size() + head.size() >= document->checksumMinSize) {
+			head = indexHead(true);
+		}
+		// the entries were written into a buffer of their own, they are appended behind the index once
+		auto entryBytes = std::exchange(buffer, Buffer{});
+		buffer.reserve(head.size() + entryBytes.size());
+		buffer.insert(buffer.end(), head.begin(), head.end());
+		buffer.insert(buffer.end(), entryBytes.begin(), entryBytes.end());
+		for (auto& block : blocks) {
+			block.end += head.size();
+		}
+		if (indexBlock) {
+			blocks.insert(blocks.begin(), Block{head.size(), 0});
+		}
+	}
+
+	// the number of records followed by one element per field that holds the values of all records,
+	// named like the field, see columns.h for their content
+	template<typename Container>
+	void writeColumns(Container& records) {
+		using record_type = typename Container::value_type;
+		static_assert(traits::has_serialize_function_v<record_type, detail::ColumnWriter>, "records of columnar sequences need a serialize function");
+		detail::ColumnWriter writer{document->context};
+		for (auto& record : records) {
+			record.serialize(writer);
+			writer.endRow();
+		}
+		(*this)[ids::rowCount] % std::uint64_t{writer.rows};
+		for (auto const& column : writer.columns) {
+			auto elem = (*this)[column.name];
+			detail::encodeColumn(column, elem.buffer);
+		}
+	}
+
+	// identifies this type, and with it the hasher of the ids, in encoding caches
+	static constexpr char cacheWriter{};
+
+	// copies the last encoding of an unchanged value, the encoding depends on the hasher, the id length and the
+	// checksums; with dictionaries the bytes depend on what was written before, those values are encoded every
+	// time, like values that use the context of the document (shared objects refer to their first occurrence)
+	template<typename T>
+	void writeCached(Cached<T>& cached) {
+		auto& cache = cached.encodingCache();
+		std::uint64_t format{0};
+		if (not document->stringDictionary and not document->fieldDictionary) {
+			format = autoIdLen | (document->checksums ? (document->checksumMinSize + 1) << 4 : 0);
+		}
+		if (format and cache.valid and cache.format == format and cache.writer == &cacheWriter) {
+			buffer      = cache.bytes;
+			hasChildren = cache.nested;
+			blocks.clear();
+			for (auto [end, header] : cache.blocks) {
+				blocks.push_back({end, header});
+			}
+			return;
+		}
+		auto uses = document->context.useCount();
+		Converter<Cached<T>>{}.serialize(*this, cached);
+		if (format and document->context.useCount() == uses) {
+			cache.bytes  = buffer;
+			cache.format = format;
+			cache.writer = &cacheWriter;
+			cache.nested = hasChildren;
+			cache.blocks.clear();
+			for (auto [end, header] : blocks) {
+				cache.blocks.emplace_back(end, header);
+			}
+			cache.valid  = true;
+		}
+	}
+
+	// appends the names that got an id since the last call as table, called on the root
+	void writeFieldNames() {
+		auto& fieldNames = document->fieldNames;
+		Serializer table(Varint{ids::fieldNames}, autoIdLen, this);
+		for (auto i{document->writtenFieldNames}; i < fieldNames.size(); ++i) {
+			Serializer entry(Varint{fieldNames[i].first}, autoIdLen, &table);
+			auto name = fieldNames[i].second;
+			transform(begin(name), end(name), std::back_inserter(entry.buffer), [](auto c) {return std::byte(c);});
+		}
+		document->writtenFieldNames = fieldNames.size();
+	}
+
+	// appends the strings that got an index since the last call as table, called on the root
+	void writeStrings() {
+		auto& stringList = document->stringList;
+		Serializer table(Varint{ids::strings}, autoIdLen, this);
+		for (auto i{document->writtenStrings}; i < stringList.size(); ++i) {
+			Serializer entry(Varint{ids::sequenceElement}, autoIdLen, &table);
+			auto string = stringList[i];
+			transform(begin(string), end(string), std::back_inserter(entry.buffer), [](auto c) {return std::byte(c);});
+		}
+		document->writtenStrings = stringList.size();
+	}
+
+	// the content of the element, wrappers like compressed() write the content of their value
+	template<typename T>
+	void writeContent(T& t) {
+		using value_type = std::remove_cv_t<T>;
+		if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
+			if (document->stringDictionary) {
+				// the bytes go to the string table behind the current root element, see writeStrings
+				auto& strings = document->strings;
+				auto it = strings.find(std::string_view{t});
+				if (it == strings.end()) {
+					it = strings.emplace(std::string{t}, strings.size()).first;
+					document->stringList.emplace_back(it->first);
+				}
+				write_raw(Varint{it->second});
+				return;
+			}
+			transform(begin(t), end(t), std::back_inserter(buffer), [](auto c) {return std::byte(c);});
+		} else if constexpr (std::is_integral_v<value_type>) {
+			detail::writeBigEndian(buffer, static_cast<std::uint64_t>(t), detail::getOctetLength(t));
+		} else if constexpr (std::is_floating_point_v<value_type>) {
+			// big endian IEEE 754 like EBML float elements, 4 bytes for float and 8 for everything else
+			using Float = std::conditional_t<std::is_same_v<value_type, float>, float, double>;
+			using Bits  = std::conditional_t<std::is_same_v<value_type, float>, std::uint32_t, std::uint64_t>;
+			Float value = t;
+			Bits bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			detail::writeBigEndian(buffer, bits, sizeof(bits));
+		} else if constexpr (std::is_enum_v<value_type>) {
+			auto value = static_cast<std::underlying_type_t<value_type>>(t);
+			writeContent(value);
+		} else if constexpr (traits::is_packed_integers_v<value_type>) {
+			using inner_type = typename value_type::container_type::value_type;
+			std::vector<std::uint64_t> values;
+			values.reserve(std::size(t.container));
+			for (auto const& v : t.container) {
+				values.emplace_back(detail::toBits(v));
+			}
+			detail::encodeIntegers<inner_type>(buffer, t.encoding, values.data(), values.size());
+		} else if constexpr (traits::is_compressed_v<value_type>) {
+			writeContent(t.value);
+			// the checksums cover the uncompressed content, the compressed bytes are no elements
+			if (needsChecksum()) {
+				Buffer content;
+				content.reserve(checksumElementSize * blockCount() + buffer.size());
+				writeBlocks(content);
+				buffer = std::move(content);
+			}
+			blocks.clear();
+			hasChildren = false;
+			buffer = detail::compressElement(t.codec, buffer, t.blockSize);
+		} else if constexpr (traits::is_indexed_map_v<value_type>) {
+			writeIndexedMap(t.map);
+		} else if constexpr (traits::is_columnar_v<value_type>) {
+			writeColumns(t.container);
+		} else if constexpr (traits::is_cached_v<value_type>) {
+			writeCached(t);
+		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
+			t.serialize(*this);
+		} else {
+			// last resort is using a converter
+			Converter<value_type> converter;
+			converter.serialize(*this, t);
+		}
+	}
+
 public:
 
 	Serializer(std::size_t _autoIdLen=4)
-		: autoIdLen{_autoIdLen}
+		: Serializer(Options{_autoIdLen})
+	{}
+
+	Serializer(Options const& options)
+		: autoIdLen{options.autoIdLen}
+		, rootDocument{std::make_shared<SerializerDocument>()}
+		, document{rootDocument.get()}
 	{
-        if (_autoIdLen > 8) {
+        if (autoIdLen > 8) {
             throw std::invalid_argument("ebml allows for ids to be of length 8 maximum!");
         }
         // if this is the root element we need to write an ebml header
-        auto headerSer = (*this)[0x0A45DFA3];
-        headerSer[0x0286] % 1; // ebml version
-        headerSer[0x02f7] % 1; // ebml reader version
-        headerSer[0x02f2] % autoIdLen; // maximum id-length
-        headerSer[0x02f3] % 8; // maximum size-length
-        headerSer[0x0282] % std::string("ebml-serializer"); // name
+        {
+            auto headerSer = (*this)[ids::header];
+            headerSer[ids::version] % 1; // ebml version
+            headerSer[ids::readVersion] % 1; // ebml reader version
+            headerSer[ids::maxIdLength] % autoIdLen; // maximum id-length
+            headerSer[ids::maxSizeLength] % 8; // maximum size-length
+            headerSer[ids::docType] % std::string("ebml-serializer"); // name
+            if (options.stringDictionary) {
+                headerSer[ids::stringDictionary] % 1;
+            }
+            if (options.fieldDictionary) {
+                headerSer[ids::fieldDictionary] % 1;
+            }
+            if (options.checksums) {
+                headerSer[ids::checksums] % 1;
+            }
+            if (options.patch) {
+                headerSer[ids::patch] % 1;
+                if (options.patchBase) {
+                    headerSer[ids::patchBase] % *options.patchBase;
+                }
+            }
+        }
+        document->stringDictionary = options.stringDictionary;
+        document->fieldDictionary  = options.fieldDictionary;
+        document->checksums        = options.checksums;
+        document->checksumMinSize  = options.checksumMinSize;
 	}
 
 	Serializer(std::size_t _autoIdLen, Serializer* _parent)
@@ -54,6 +413,7 @@ public:
 		if (not parent) {
             throw std::invalid_argument("need a parent serializer");
 		}
+		document = parent->document;
 	}
 
 	Serializer(Varint const& _id, std::size_t _autoIdLen, Serializer* _parent)
@@ -63,9 +423,27 @@ public:
 	~Serializer()
 	{
 		if (parent and id) {
+			auto start = parent->buffer.size();
 			parent->write_raw(*id);
-			parent->write_raw(VarLen{buffer.size()});
-			parent->write_raw(buffer);
+			auto covered = needsChecksum();
+			if (covered) {
+				parent->write_raw(VarLen{buffer.size() + checksumElementSize * blockCount()});
+				auto header = parent->buffer.size() - start;
+				writeBlocks(parent->buffer);
+				parent->noteChild(start, header, true);
+			} else {
+				parent->write_raw(VarLen{buffer.size()});
+				parent->write_raw(buffer);
+				parent->noteChild(start, 0, false);
+			}
+			parent->hasChildren = true;
+			// with dictionaries the names of new fields and new strings follow the root element that introduced them
+			if (not parent->parent and document->writtenFieldNames < document->fieldNames.size()) {
+				parent->writeFieldNames();
+			}
+			if (not parent->parent and document->writtenStrings < document->stringList.size()) {
+				parent->writeStrings();
+			}
 		}
 	}
 
@@ -78,48 +456,83 @@ public:
 	}
 
 	Serializer operator[](std::string_view const& name) {
-		return (*this)[genID<Hasher>(name, autoIdLen)];
+		if (document->fieldDictionary) {
+			return (*this)[fieldId(name)];
+		}
+		auto id = genID<Hasher>(name, autoIdLen);
+		// checksums are only recognized in documents that have them
+		if (ids::isReserved(id.value()) and (id != ids::crc32 or document->checksums)) {
+			throw std::runtime_error("the id of field " + std::string{name} + " is reserved, choose another name, a longer id length or a field dictionary");
+		}
+		return (*this)[id];
 	}
 
 	auto getBuffer() const -> decltype(buffer) const& { return buffer; }
 
+	// leaves this element out of the stream, an element of a sequence keeps its position as empty marker
+	void omit() {
+		buffer.clear();
+		blocks.clear();
+		hasChildren = false;
+		if (id and *id == ids::sequenceElement) {
+			id = Varint{ids::absentElement};
+		} else {
+			id.reset();
+		}
+	}
+
+	Context& getContext() { return document->context; }
+
 	template<typename T>
 	void operator%(T&& t) {
         if (not id) {
             throw std::runtime_error("cannot serialize into an EBML node without an ID");
         }
         buffer.clear();
+        blocks.clear();
+        hasChildren = false;
 		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
-		if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
-			transform(begin(t), end(t), std::back_inserter(buffer), [](auto c) {return std::byte(c);});
-		} else if constexpr (std::is_integral_v<value_type>) {
-			auto numBytes = detail::getOctetLength(t);
-			while (numBytes) {
-				--numBytes;
-				buffer.emplace_back(std::byte((t >> (8*numBytes)) & 0xff));
-			};
-		} else if constexpr (std::is_enum_v<value_type>) {
-			(*this) % static_cast<std::underlying_type_t<value_type>>(t);
-		} else if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
-			t.serialize(*this);
-		} else {
-			// last resort is using a converter
-			Converter<value_type> converter;
-			converter.serialize(*this, t);
+		SERIALIZER_INSTRUMENT(value_type, Direction::Serialize, [&] { return buffer.size(); });
+		writeContent(t);
+		// values that start like a compressed element are written as one with a stored block, the Deserializer
+		// decompresses every compressed element it reads
+		if constexpr (std::is_arithmetic_v<value_type> or std::is_enum_v<value_type> or std::is_same_v<value_type, std::string>
+		              or std::is_same_v<value_type, std::string_view> or traits::is_packed_integers_v<value_type>) {
+			if (detail::compressedContent(buffer.data(), buffer.data() + buffer.size())) {
+				buffer = detail::compressElement(Codec::None, buffer, buffer.size());
+			}
 		}
 	}
 
 	template<typename IterT>
 	void serializeSequence(IterT begin, IterT end) {
 		for (; begin != end; std::advance(begin, 1)) {
-			Serializer(Varint{0x01}, autoIdLen, this) % *begin;
+			Serializer(Varint{ids::sequenceElement}, autoIdLen, this) % *begin;
 		}
 	}
+
+	// appends one positional element, cb writes it through the Serializer it is called with
+	template<typename ElemCb>
+	void serializeElement(ElemCb&& cb) {
+		Serializer elem(Varint{ids::sequenceElement}, autoIdLen, this);
+		cb(elem);
+	}
+
+	// appends one entry of a map as element with the children "first" and "second"
+	template<typename KeyCb, typename ValueCb>
+	void serializeEntry(KeyCb&& keyCb, ValueCb&& valueCb) {
+		serializeElement([&](Serializer& elem) {
+			{
+				auto key = elem["first"];
+				keyCb(key);
+			}
+			auto value = elem["second"];
+			valueCb(value);
+		});
+	}
 };
 }
 
 using Serializer = detail::Serializer<detail::Hash>;
 }
 }
-
-
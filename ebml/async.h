@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include "serializer/Async.h"
+
+#include "Deserializer.h"
+#include "Serializer.h"
+#include "hasher.h"
+#include "ids.h"
+#include "validate.h"
+#include "varint.h"
+
+namespace serializer {
+namespace ebml {
+
+// Writes a document to a file descriptor one root field at a time, each field is encoded on its own and written in
+// chunks of chunkSize bytes while the next one is encoded:
+//     serializer::IoContext context{2};
+//     serializer::ebml::AsyncSerializer out{context, fd};
+//     co_await out.write("config", config);
+//     co_await out.write("state", state);
+//     co_await out.flush();
+// Memory is bounded by the encodings of two root fields instead of the whole document, so large snapshots should be
+// split into several fields. The stream is an ordinary document. Dictionaries span the whole document and cannot
+// be streamed. Without flush() the last field is still written as long as the IoContext and the fd exist, but its
+// errors are lost.
+class AsyncSerializer {
+	IoContext& context;
+	int fd;
+	Options options;
+	std::size_t chunkSize;
+	std::size_t headerSize;
+	bool headerWritten{false};
+	// the previous field on its way to the fd
+	std::optional<Job<void>> pending;
+
+	// static, the AsyncSerializer may be destroyed before the task finishes
+	static Task<void> writeOut(IoContext& context, int fd, std::size_t chunkSize, std::unique_ptr<Serializer> serializer,
+	                           std::size_t offset) {
+		auto const& buffer = serializer->getBuffer();
+		while (offset < buffer.size()) {
+			auto written = co_await context.write(fd, buffer.data() + offset, std::min(chunkSize, buffer.size() - offset));
+			if (written == 0) {
+				throw std::runtime_error("cannot write ebml stream! the file descriptor takes no more bytes");
+			}
+			offset += written;
+		}
+	}
+
+public:
+	AsyncSerializer(IoContext& _context, int _fd, Options const& _options = {}, std::size_t _chunkSize = 1 << 16)
+		: context{_context}
+		, fd{_fd}
+		, options{_options}
+		, chunkSize{_chunkSize}
+	{
+		if (options.stringDictionary or options.fieldDictionary) {
+			throw std::invalid_argument("dictionaries cannot be streamed");
+		}
+		if (chunkSize == 0) {
+			throw std::invalid_argument("chunks need at least one byte");
+		}
+		headerSize = Serializer{options}.getBuffer().size();
+		context.attach(fd);
+	}
+
+	// encodes value on the calling thread, it may change again once the task finished
+	template<typename T>
+	Task<void> write(std::string_view name, T& value) {
+		auto serializer = std::make_unique<Serializer>(options);
+		(*serializer)[name] % value;
+		co_await flush();
+		auto offset = headerWritten ? headerSize : 0;
+		headerWritten = true;
+		pending.emplace(context.start(writeOut(context, fd, chunkSize, std::move(serializer), offset)));
+	}
+
+	// waits until everything is written, rethrows the errors of writing
+	Task<void> flush() {
+		if (pending) {
+			auto job = std::move(*pending);
+			pending.reset();
+			co_await job;
+		}
+	}
+};
+
+// Reads a document from a file descriptor one root element at a time, chunkSize bytes per read. Only the header and
+// the element being read are kept in memory. Fields are found in the order they were written, read() skips the
+// elements before the field and returns false if the stream ends without it.
+//     serializer::ebml::AsyncDeserializer in{context, fd};
+//     co_await in.read("config", config);
+class AsyncDeserializer {
+	IoContext& context;
+	int fd;
+	std::size_t chunkSize;
+	// read but not consumed are the bytes from consumed on
+	Buffer input;
+	std::size_t consumed{0};
+	// the header followed by the element being read
+	Buffer document;
+	std::size_t headerSize{0};
+	std::size_t autoIdLen{0};
+
+	// false if the stream ends before count more bytes are available
+	Task<bool> fill(std::size_t count) {
+		while (input.size() - consumed < count) {
+			if (consumed > 0) {
+				input.erase(input.begin(), input.begin() + static_cast<std::ptrdiff_t>(consumed));
+				consumed = 0;
+			}
+			auto size = input.size();
+			input.resize(size + chunkSize);
+			auto read = co_await context.read(fd, input.data() + size, chunkSize);
+			input.resize(size + read);
+			if (read == 0) {
+				co_return false;
+			}
+		}
+		co_return true;
+	}
+
+	// a varint of the id or size of an element, its bytes go to the document, 0 if the stream ends before an id
+	Task<std::uint64_t> readVarint(bool id) {
+		if (not co_await fill(1)) {
+			if (id) {
+				co_return 0;
+			}
+			throw std::runtime_error("invalid ebml stream! stream ends inside of an element");
+		}
+		if (input[consumed] == std::byte{0}) {
+			throw std::runtime_error("invalid ebml stream! invalid varint");
+		}
+		auto len = varintLength(input[consumed]);
+		if (not co_await fill(len)) {
+			throw std::runtime_error("invalid ebml stream! stream ends inside of an element");
+		}
+		auto begin = input.data() + consumed;
+		auto value = detail::readBigEndian(begin, len) & (~std::uint64_t{0} >> (64 - 7*len));
+		if (id and value == 0) {
+			throw std::runtime_error("invalid ebml stream! element without id");
+		}
+		document.insert(document.end(), begin, begin + len);
+		consumed += len;
+		co_return value;
+	}
+
+	// appends the next size bytes of the stream to the document
+	Task<void> readContent(std::uint64_t size) {
+		auto buffered = static_cast<std::size_t>(std::min<std::uint64_t>(size, input.size() - consumed));
+		auto begin = input.data() + consumed;
+		document.insert(document.end(), begin, begin + buffered);
+		consumed += buffered;
+		size -= buffered;
+		while (size > 0) {
+			auto offset = document.size();
+			document.resize(offset + static_cast<std::size_t>(std::min<std::uint64_t>(size, chunkSize)));
+			auto read = co_await context.read(fd, document.data() + offset, document.size() - offset);
+			document.resize(offset + read);
+			if (read == 0) {
+				throw std::runtime_error("invalid ebml stream! stream ends inside of an element");
+			}
+			size -= read;
+		}
+	}
+
+	// drops the next size bytes of the stream
+	Task<void> skip(std::uint64_t size) {
+		while (true) {
+			auto buffered = static_cast<std::size_t>(std::min<std::uint64_t>(size, input.size() - consumed));
+			consumed += buffered;
+			size -= buffered;
+			if (size == 0) {
+				co_return;
+			}
+			if (not co_await fill(1)) {
+				throw std::runtime_error("invalid ebml stream! stream ends inside of an element");
+			}
+		}
+	}
+
+	Task<void> readHeader() {
+		if (co_await readVarint(true) != ids::header) {
+			throw std::runtime_error("invalid ebml stream! the stream does not start with a header");
+		}
+		co_await readContent(co_await readVarint(false));
+		headerSize = document.size();
+		std::byte const* end = document.data();
+		detail::ElementView header;
+		detail::readElement(end, end + headerSize, header);
+		autoIdLen = 4;
+		for (auto b = header.content; b != end;) {
+			detail::ElementView e;
+			if (not detail::readElement(b, end, e)) {
+				throw std::runtime_error("invalid ebml stream! element does not fit into the header");
+			}
+			if (e.id == ids::docType or e.size > 8) {
+				continue;
+			}
+			auto value = detail::readBigEndian(e.content, e.size);
+			if (e.id == ids::maxIdLength) {
+				autoIdLen = static_cast<std::size_t>(value);
+			} else if ((e.id == ids::stringDictionary or e.id == ids::fieldDictionary) and value != 0) {
+				throw std::runtime_error("cannot stream ebml! the document has dictionaries");
+			}
+		}
+		if (autoIdLen < 1 or autoIdLen > 8) {
+			throw std::runtime_error("cannot deserialize stream! maximum id length out of range");
+		}
+	}
+
+public:
+	AsyncDeserializer(IoContext& _context, int _fd, std::size_t _chunkSize = 1 << 16)
+		: context{_context}
+		, fd{_fd}
+		, chunkSize{_chunkSize}
+	{
+		if (chunkSize == 0) {
+			throw std::invalid_argument("chunks need at least one byte");
+		}
+		context.attach(fd);
+	}
+
+	// reads the root field name into value, false if the stream ends before it
+	template<typename T>
+	Task<bool> read(std::string_view name, T& value) {
+		if (headerSize == 0) {
+			co_await readHeader();
+		}
+		auto id = genID<detail::Hash>(name, static_cast<int>(autoIdLen)).value();
+		while (true) {
+			document.resize(headerSize);
+			auto elementId = co_await readVarint(true);
+			if (elementId == 0) {
+				co_return false;
+			}
+			auto size = co_await readVarint(false);
+			if (elementId != id) {
+				co_await skip(size);
+				continue;
+			}
+			co_await readContent(size);
+			Deserializer deserializer{document.data(), document.size()};
+			deserializer[name] % value;
+			co_return true;
+		}
+	}
+};
+
+}
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "serializer/Context.h"
+#include "serializer/IntegerEncoding.h"
+#include "serializer/traits.h"
+
+#include "packing.h"
+#include "varint.h"
+
+namespace serializer {
+namespace ebml {
+namespace detail
+{
+
+// values of one field of all records of a columnar sequence
+struct Column {
+	enum class Type : std::uint8_t { Signed, Unsigned, Float, Double, String };
+	std::string name;
+	Type type{Type::Signed};
+	// integers sign extended to 64 bit, floats as their bits, strings as index into distinct
+	std::vector<std::uint64_t> values;
+	// strings in the order of their first occurrence, indices holds views into them
+	std::deque<std::string> distinct;
+	std::unordered_map<std::string_view, std::uint64_t> indices;
+};
+
+template<typename T>
+inline constexpr bool is_column_value_v = std::is_arithmetic_v<T> or std::is_enum_v<T>
+                                       or std::is_same_v<T, std::string> or std::is_same_v<T, std::string_view>;
+
+template<typename T>
+constexpr Column::Type columnType() {
+	if constexpr (std::is_enum_v<T>) {
+		return columnType<std::underlying_type_t<T>>();
+	} else if constexpr (std::is_same_v<T, std::string> or std::is_same_v<T, std::string_view>) {
+		return Column::Type::String;
+	} else if constexpr (std::is_same_v<T, float>) {
+		return Column::Type::Float;
+	} else if constexpr (std::is_floating_point_v<T>) {
+		return Column::Type::Double;
+	} else if constexpr (std::is_signed_v<T>) {
+		return Column::Type::Signed;
+	} else {
+		return Column::Type::Unsigned;
+	}
+}
+
+// the records serialize themselves into this adapter, every field appends its value to its column.
+// The first record decides the columns, all others have to write the same fields in the same order.
+struct ColumnWriter : traits::SerializerTraits<false> {
+	struct Field {
+		Column& column;
+
+		template<typename T>
+		void operator%(T&& t) {
+			using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+			static_assert(is_column_value_v<value_type>, "records of columnar sequences can only write scalars, enums and strings");
+			constexpr auto type = columnType<value_type>();
+			if (column.values.empty()) {
+				column.type = type;
+			} else if (column.type != type) {
+				throw std::invalid_argument("field " + column.name + " of a columnar sequence changes its type");
+			}
+			if constexpr (type == Column::Type::String) {
+				auto it = column.indices.find(std::string_view{t});
+				if (it == column.indices.end()) {
+					auto const& stored = column.distinct.emplace_back(t);
+					it = column.indices.emplace(stored, column.distinct.size() - 1).first;
+				}
+				column.values.emplace_back(it->second);
+			} else if constexpr (type == Column::Type::Float or type == Column::Type::Double) {
+				using Float = std::conditional_t<type == Column::Type::Float, float, double>;
+				using Bits  = std::conditional_t<type == Column::Type::Float, std::uint32_t, std::uint64_t>;
+				Float value = t;
+				Bits bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				column.values.emplace_back(bits);
+			} else if constexpr (std::is_enum_v<value_type>) {
+				column.values.emplace_back(toBits(static_cast<std::underlying_type_t<value_type>>(t)));
+			} else {
+				column.values.emplace_back(toBits(t));
+			}
+		}
+	};
+
+	Context& context;
+	// a deque keeps the columns in place, their indices point into them
+	std::deque<Column> columns;
+	std::size_t rows{0};
+	std::size_t field{0};
+
+	ColumnWriter(Context& _context) : context{_context} {}
+
+	Context& getContext() {
+		return context;
+	}
+
+	Field operator[](std::string_view name) {
+		if (rows == 0 and field == columns.size()) {
+			for (auto const& column : columns) {
+				if (column.name == name) {
+					throw std::invalid_argument("records of columnar sequences can write field " + std::string{name} + " only once");
+				}
+			}
+			columns.emplace_back().name = name;
+		}
+		if (field == columns.size() or columns[field].name != name) {
+			throw std::invalid_argument("the records of a columnar sequence have to write the same fields in the same order");
+		}
+		return {columns[field++]};
+	}
+
+	void endRow() {
+		if (field != columns.size()) {
+			throw std::invalid_argument("the records of a columnar sequence have to write the same fields in the same order");
+		}
+		++rows;
+		field = 0;
+	}
+};
+
+// content of the element of a column: integers packed like packed() sequences, floats as block of
+// big endian values and strings as [size][packed lengths of the distinct strings][size][packed
+// indices into the distinct strings][the distinct strings], sizes are LEB128 encoded
+inline void encodeColumn(Column const& column, std::vector<std::byte>& out) {
+	auto const& values = column.values;
+	switch (column.type) {
+	case Column::Type::Signed:
+		encodeIntegers<std::int64_t>(out, IntegerEncoding::Auto, values.data(), values.size());
+		return;
+	case Column::Type::Unsigned:
+		encodeIntegers<std::uint64_t>(out, IntegerEncoding::Auto, values.data(), values.size());
+		return;
+	case Column::Type::Float:
+	case Column::Type::Double: {
+		auto width = column.type == Column::Type::Float ? 4 : 8;
+		out.reserve(out.size() + width * values.size());
+		for (auto v : values) {
+			writeBigEndian(out, v, width);
+		}
+		return;
+	}
+	case Column::Type::String: {
+		std::vector<std::uint64_t> lengths;
+		lengths.reserve(column.distinct.size());
+		for (auto const& s : column.distinct) {
+			lengths.emplace_back(s.size());
+		}
+		std::vector<std::byte> block;
+		for (auto const* integers : {&std::as_const(lengths), &values}) {
+			block.clear();
+			encodeIntegers<std::uint64_t>(block, IntegerEncoding::Auto, integers->data(), integers->size());
+			writeLeb128(out, block.size());
+			out.insert(out.end(), block.begin(), block.end());
+		}
+		for (auto const& s : column.distinct) {
+			std::transform(s.begin(), s.end(), std::back_inserter(out), [](char c) { return std::byte(c); });
+		}
+		return;
+	}
+	}
+}
+
+struct DecodedColumn {
+	std::vector<std::uint64_t> values;
+	std::vector<std::string_view> distinct;
+};
+
+// decodes the column of a field of type T, it has to hold a value for each of the rows
+template<typename T>
+DecodedColumn decodeColumn(std::byte const* b, std::byte const* end, std::uint64_t rows) {
+	constexpr auto type = columnType<T>();
+	DecodedColumn column;
+	if constexpr (type == Column::Type::String) {
+		auto block = [&] {
+			auto size = readLeb128(b, end);
+			if (size > static_cast<std::uint64_t>(end - b)) {
+				throw std::runtime_error("invalid ebml stream! string column is too short");
+			}
+			auto values = decodeIntegers<std::uint64_t>(b, b + size);
+			b += size;
+			return values;
+		};
+		auto lengths  = block();
+		column.values = block();
+		column.distinct.reserve(lengths.size());
+		for (auto len : lengths) {
+			if (len > static_cast<std::uint64_t>(end - b)) {
+				throw std::runtime_error("invalid ebml stream! string column is too short");
+			}
+			column.distinct.emplace_back(reinterpret_cast<char const*>(b), static_cast<std::size_t>(len));
+			b += len;
+		}
+		for (auto index : column.values) {
+			if (index >= column.distinct.size()) {
+				throw std::runtime_error("invalid ebml stream! string index of a column out of range");
+			}
+		}
+	} else if constexpr (type == Column::Type::Float or type == Column::Type::Double) {
+		constexpr std::size_t width = type == Column::Type::Float ? 4 : 8;
+		auto size = static_cast<std::size_t>(end - b);
+		if (size % width != 0 or size / width != rows) {
+			throw std::runtime_error("invalid ebml stream! column does not have a value for every record");
+		}
+		column.values.resize(size / width);
+		for (auto& v : column.values) {
+			v = readBigEndian(b, width);
+			b += width;
+		}
+	} else {
+		column.values = decodeIntegers<std::conditional_t<type == Column::Type::Signed, std::int64_t, std::uint64_t>>(b, end);
+	}
+	if (column.values.size() != rows) {
+		throw std::runtime_error("invalid ebml stream! column does not have a value for every record");
+	}
+	return column;
+}
+
+// the records deserialize themselves from this adapter, every field reads the value of the current
+// row from its column. Columns are found through lookup(name), which returns their content and its
+// size or -1 for missing columns, and are decoded when they are read the first time.
+template<typename Lookup>
+struct ColumnReader : traits::SerializerTraits<true> {
+	struct Source {
+		std::string name;
+		std::byte const* content;
+		std::ptrdiff_t size;
+		std::optional<DecodedColumn> decoded;
+	};
+
+	struct Field {
+		ColumnReader& reader;
+		Source& source;
+
+		template<typename T>
+		void operator%(T&& t) {
+			using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+			static_assert(is_column_value_v<value_type>, "records of columnar sequences can only read scalars, enums and strings");
+			// missing columns keep the value
+			if (source.size < 0) {
+				return;
+			}
+			if (not source.decoded) {
+				source.decoded = decodeColumn<value_type>(source.content, source.content + source.size, reader.rows);
+			}
+			auto const& column = *source.decoded;
+			auto bits = column.values[reader.row];
+			if constexpr (std::is_same_v<value_type, std::string> or std::is_same_v<value_type, std::string_view>) {
+				// string_views point into the deserialized buffer
+				t = value_type(column.distinct[bits]);
+			} else if constexpr (std::is_same_v<value_type, bool>) {
+				t = bits != 0;
+			} else if constexpr (std::is_same_v<value_type, float>) {
+				auto bits32 = static_cast<std::uint32_t>(bits);
+				std::memcpy(&t, &bits32, sizeof(t));
+			} else if constexpr (std::is_floating_point_v<value_type>) {
+				double value;
+				std::memcpy(&value, &bits, sizeof(value));
+				t = static_cast<value_type>(value);
+			} else if constexpr (std::is_enum_v<value_type>) {
+				t = static_cast<value_type>(static_cast<std::underlying_type_t<value_type>>(bits));
+			} else {
+				t = static_cast<value_type>(bits);
+			}
+		}
+	};
+
+	Context& context;
+	Lookup lookup;
+	std::uint64_t rows;
+	std::uint64_t row{0};
+	std::size_t field{0};
+	std::vector<Source> sources;
+
+	ColumnReader(Context& _context, Lookup _lookup, std::uint64_t _rows)
+		: context{_context}, lookup{std::move(_lookup)}, rows{_rows} {}
+
+	Context& getContext() {
+		return context;
+	}
+
+	void beginRow(std::uint64_t _row) {
+		row   = _row;
+		field = 0;
+	}
+
+	// true if a field read so far has a column in the stream
+	bool hasColumns() const {
+		return std::any_of(sources.begin(), sources.end(), [](Source const& source) { return source.size >= 0; });
+	}
+
+	Field operator[](std::string_view name) {
+		// every record visits the fields in the same order, others are searched
+		auto i = field++;
+		if (i >= sources.size() or sources[i].name != name) {
+			i = 0;
+			while (i < sources.size() and sources[i].name != name) {
+				++i;
+			}
+			if (i == sources.size()) {
+				auto [content, size] = lookup(name);
+				sources.push_back({std::string{name}, content, size, std::nullopt});
+			}
+		}
+		return {*this, sources[i]};
+	}
+};
+
+}
+}
+}
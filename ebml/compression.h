@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef SERIALIZER_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "serializer/Compression.h"
+
+#include "ids.h"
+#include "packing.h"
+#include "varint.h"
+
+namespace serializer {
+namespace ebml {
+namespace detail
+{
+
+// LZ77 in the spirit of LZ4: a stream of sequences, each made of
+//   [token: literal length (high nibble) | match length - 4 (low nibble)]
+//   [255-continued literal length][literals][2 byte offset][255-continued match length]
+// The last sequence only holds literals.
+namespace lz
+{
+
+inline constexpr std::size_t minMatch  = 4;
+inline constexpr std::size_t maxOffset = 0xffff;
+inline constexpr int hashBits = 14;
+
+inline std::uint32_t read32(std::byte const* p) {
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline std::uint32_t hash(std::uint32_t v) {
+	return (v * 2654435761U) >> (32 - hashBits);
+}
+
+inline void writeLength(std::vector<std::byte>& out, std::size_t len) {
+	while (len >= 255) {
+		out.emplace_back(std::byte{255});
+		len -= 255;
+	}
+	out.emplace_back(std::byte(len));
+}
+
+inline void writeSequence(std::vector<std::byte>& out, std::byte const* literals, std::size_t litLen, std::size_t offset, std::size_t matchLen) {
+	auto litToken   = std::min<std::size_t>(litLen, 15);
+	auto matchToken = matchLen ? std::min<std::size_t>(matchLen - minMatch, 15) : 0;
+	out.emplace_back(std::byte((litToken << 4) | matchToken));
+	if (litToken == 15) {
+		writeLength(out, litLen - 15);
+	}
+	out.insert(out.end(), literals, literals + litLen);
+	if (matchLen) {
+		out.emplace_back(std::byte(offset & 0xff));
+		out.emplace_back(std::byte(offset >> 8));
+		if (matchToken == 15) {
+			writeLength(out, matchLen - minMatch - 15);
+		}
+	}
+}
+
+inline void compress(std::byte const* src, std::size_t len, std::vector<std::byte>& out) {
+	std::vector<std::uint32_t> table(std::size_t{1} << hashBits, 0);
+	std::size_t anchor{0};
+	std::size_t pos{0};
+	// positions are stored +1 so that 0 marks an empty slot
+	while (pos + minMatch <= len) {
+		auto value = read32(src + pos);
+		auto& slot = table[hash(value)];
+		auto candidate = slot;
+		slot = static_cast<std::uint32_t>(pos + 1);
+		if (candidate == 0 or pos + 1 - candidate > maxOffset or read32(src + candidate - 1) != value) {
+			++pos;
+			continue;
+		}
+		auto ref = candidate - 1;
+		auto matchLen = minMatch;
+		while (pos + matchLen < len and src[ref + matchLen] == src[pos + matchLen]) {
+			++matchLen;
+		}
+		writeSequence(out, src + anchor, pos - anchor, pos - ref, matchLen);
+		pos += matchLen;
+		anchor = pos;
+	}
+	writeSequence(out, src + anchor, len - anchor, 0, 0);
+}
+
+inline std::size_t readLength(std::byte const*& in, std::byte const* end, std::size_t len) {
+	while (true) {
+		if (in == end) {
+			throw std::runtime_error("invalid lz stream! truncated length");
+		}
+		auto b = std::to_integer<std::size_t>(*in++);
+		len += b;
+		if (b != 255) {
+			return len;
+		}
+	}
+}
+
+inline void decompress(std::byte const* in, std::size_t inLen, std::byte* out, std::size_t outLen) {
+	auto end = in + inLen;
+	std::size_t pos{0};
+	while (true) {
+		if (in == end) {
+			throw std::runtime_error("invalid lz stream! missing token");
+		}
+		auto token  = std::to_integer<std::size_t>(*in++);
+		auto litLen = token >> 4;
+		if (litLen == 15) {
+			litLen = readLength(in, end, litLen);
+		}
+		if (litLen > static_cast<std::size_t>(end - in) or litLen > outLen - pos) {
+			throw std::runtime_error("invalid lz stream! literals out of range");
+		}
+		std::memcpy(out + pos, in, litLen);
+		in  += litLen;
+		pos += litLen;
+		if (in == end) {
+			break;
+		}
+		if (end - in < 2) {
+			throw std::runtime_error("invalid lz stream! truncated offset");
+		}
+		auto offset = std::to_integer<std::size_t>(in[0]) | (std::to_integer<std::size_t>(in[1]) << 8);
+		in += 2;
+		auto matchLen = (token & 0x0f) + minMatch;
+		if ((token & 0x0f) == 15) {
+			matchLen = readLength(in, end, matchLen);
+		}
+		if (offset == 0 or offset > pos or matchLen > outLen - pos) {
+			throw std::runtime_error("invalid lz stream! match out of range");
+		}
+		// matches may overlap their own output
+		for (std::size_t i{0}; i < matchLen; ++i, ++pos) {
+			out[pos] = out[pos - offset];
+		}
+	}
+	if (pos != outLen) {
+		throw std::runtime_error("invalid lz stream! wrong decompressed size");
+	}
+}
+
+}
+
+inline void compressBlock(Codec codec, std::byte const* src, std::size_t len, std::vector<std::byte>& out) {
+	switch (codec) {
+	case Codec::LZ:
+		lz::compress(src, len, out);
+		return;
+	case Codec::Deflate: {
+#ifdef SERIALIZER_USE_ZLIB
+		auto offset = out.size();
+		auto bound = compressBound(static_cast<uLong>(len));
+		out.resize(offset + bound);
+		auto destLen = bound;
+		if (compress2(reinterpret_cast<Bytef*>(out.data() + offset), &destLen, reinterpret_cast<Bytef const*>(src), static_cast<uLong>(len), Z_DEFAULT_COMPRESSION) != Z_OK) {
+			throw std::runtime_error("deflate failed");
+		}
+		out.resize(offset + destLen);
+		return;
+#else
+		throw std::runtime_error("deflate is not available, define SERIALIZER_USE_ZLIB and link against zlib");
+#endif
+	}
+	default:
+		out.insert(out.end(), src, src + len);
+	}
+}
+
+inline void decompressBlock(Codec codec, std::byte const* in, std::size_t inLen, std::byte* out, std::size_t outLen) {
+	switch (codec) {
+	case Codec::LZ:
+		lz::decompress(in, inLen, out, outLen);
+		return;
+	case Codec::Deflate: {
+#ifdef SERIALIZER_USE_ZLIB
+		auto destLen = static_cast<uLongf>(outLen);
+		if (uncompress(reinterpret_cast<Bytef*>(out), &destLen, reinterpret_cast<Bytef const*>(in), static_cast<uLong>(inLen)) != Z_OK or destLen != outLen) {
+			throw std::runtime_error("invalid deflate stream");
+		}
+		return;
+#else
+		throw std::runtime_error("deflate is not available, define SERIALIZER_USE_ZLIB and link against zlib");
+#endif
+	}
+	default:
+		throw std::runtime_error("invalid ebml stream! unknown compression codec");
+	}
+}
+
+// a helper thread decodes at least parallelBytes of raw content, which keeps the cost of starting it below one
+// percent of its work, smaller elements are decoded by the calling thread alone
+inline constexpr std::size_t parallelBytes = std::size_t{1} << 20;
+
+// helper threads of all running decompressions, bounded by the number of cores besides the calling thread
+inline std::atomic<unsigned> decompressionHelpers{0};
+
+inline unsigned reserveHelpers(std::size_t wanted) {
+	auto limit = std::max(1U, std::thread::hardware_concurrency()) - 1;
+	auto active = decompressionHelpers.load(std::memory_order_relaxed);
+	while (true) {
+		auto granted = static_cast<unsigned>(std::min<std::size_t>(wanted, active < limit ? limit - active : 0));
+		if (granted == 0 or decompressionHelpers.compare_exchange_weak(active, active + granted, std::memory_order_relaxed)) {
+			return granted;
+		}
+	}
+}
+
+// the content of the ids::compressed element that makes up the element from b to end, nullptr if the element
+// was not written compressed
+inline std::byte const* compressedContent(std::byte const* b, std::byte const* end) {
+	constexpr Varint id{ids::compressed};
+	if (end - b < 3 or not std::equal(id.begin(), id.end(), b) or b[2] == std::byte{0}) {
+		return nullptr;
+	}
+	b += id.size();
+	auto len = varintLength(*b);
+	if (static_cast<std::size_t>(end - b) < len) {
+		return nullptr;
+	}
+	auto size = readBigEndian(b, len) & (~std::uint64_t{0} >> (64 - 7*len));
+	return size == static_cast<std::uint64_t>(end - b) - len ? b + len : nullptr;
+}
+
+// the content of a compressed element is a single ids::compressed element that holds
+// [codec][raw size][block size] followed by every block as [compressed size << 1 | stored][bytes]
+inline std::vector<std::byte> compressElement(Codec codec, std::vector<std::byte> const& raw, std::size_t blockSize) {
+	blockSize = std::max<std::size_t>(blockSize, 1);
+	std::vector<std::byte> out;
+	out.emplace_back(std::byte(codec));
+	writeLeb128(out, raw.size());
+	writeLeb128(out, blockSize);
+	std::vector<std::byte> block;
+	for (std::size_t offset{0}; offset < raw.size(); offset += blockSize) {
+		auto len = std::min(blockSize, raw.size() - offset);
+		block.clear();
+		compressBlock(codec, raw.data() + offset, len, block);
+		if (codec == Codec::None or block.size() >= len) {
+			writeLeb128(out, (len << 1) | 1);
+			out.insert(out.end(), raw.data() + offset, raw.data() + offset + len);
+		} else {
+			writeLeb128(out, block.size() << 1);
+			out.insert(out.end(), block.begin(), block.end());
+		}
+	}
+	Varint id{ids::compressed};
+	VarLen size{out.size()};
+	out.insert(out.begin(), size.begin(), size.end());
+	out.insert(out.begin(), id.begin(), id.end());
+	return out;
+}
+
+inline std::vector<std::byte> decompressElement(std::byte const* in, std::byte const* end) {
+	in = compressedContent(in, end);
+	if (not in) {
+		throw std::runtime_error("invalid ebml stream! the element is not compressed");
+	}
+	if (in == end) {
+		return {};
+	}
+	auto codec     = Codec(std::to_integer<std::uint8_t>(*in++));
+	auto rawSize   = readLeb128(in, end);
+	auto blockSize = readLeb128(in, end);
+	auto remaining = static_cast<std::uint64_t>(end - in);
+	// every block needs at least one byte and no codec expands more than ~1:1000
+	if (blockSize == 0 or rawSize / blockSize + (rawSize % blockSize != 0) > remaining or rawSize / 2048 > remaining) {
+		throw std::runtime_error("invalid ebml stream! compressed element is too short");
+	}
+
+	struct Block {
+		std::byte const* data;
+		std::size_t len;
+		bool stored;
+	};
+	std::vector<Block> blocks;
+	for (std::uint64_t offset{0}; offset < rawSize; offset += blockSize) {
+		auto header = readLeb128(in, end);
+		auto len = header >> 1;
+		if (len > static_cast<std::uint64_t>(end - in)) {
+			throw std::runtime_error("invalid ebml stream! compressed block is too short");
+		}
+		blocks.push_back({in, len, (header & 1) != 0});
+		in += len;
+	}
+
+	std::vector<std::byte> raw(rawSize);
+	auto decodeBlock = [&](std::size_t i) {
+		auto offset = i * blockSize;
+		auto len = std::min<std::size_t>(blockSize, rawSize - offset);
+		if (blocks[i].stored) {
+			if (blocks[i].len != len) {
+				throw std::runtime_error("invalid ebml stream! stored block has the wrong size");
+			}
+			std::memcpy(raw.data() + offset, blocks[i].data, len);
+		} else {
+			decompressBlock(codec, blocks[i].data, blocks[i].len, raw.data() + offset, len);
+		}
+	};
+
+	auto wanted  = std::min<std::size_t>(blocks.size(), rawSize / parallelBytes);
+	auto helpers = wanted > 1 ? reserveHelpers(wanted - 1) : 0U;
+	struct Release {
+		unsigned count;
+		~Release() {
+			decompressionHelpers.fetch_sub(count, std::memory_order_relaxed);
+		}
+	} release{helpers};
+	std::size_t workers = helpers + 1;
+	auto work = [&](std::size_t w) {
+		for (auto i = w; i < blocks.size(); i += workers) {
+			decodeBlock(i);
+		}
+	};
+	// destroyed before release, they wait for the helpers
+	std::vector<std::future<void>> results;
+	for (std::size_t w{1}; w < workers; ++w) {
+		results.emplace_back(std::async(std::launch::async, work, w));
+	}
+	work(0);
+	for (auto& result : results) {
+		result.get();
+	}
+	return raw;
+}
+
+}
+}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define SERIALIZER_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SERIALIZER_CRC32C_ARM
+#endif
+
+namespace serializer::ebml::detail
+{
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78)
+inline constexpr std::uint32_t crc32cPolynomial = 0x82F63B78;
+
+inline constexpr auto crc32cTable = [] {
+	std::array<std::uint32_t, 256> table{};
+	for (std::uint32_t i{0}; i < 256; ++i) {
+		auto crc = i;
+		for (int bit{0}; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (crc & 1 ? crc32cPolynomial : 0);
+		}
+		table[i] = crc;
+	}
+	return table;
+}();
+
+inline std::uint32_t crc32cTableDriven(std::uint32_t crc, std::byte const* data, std::size_t size) {
+	for (std::size_t i{0}; i < size; ++i) {
+		crc = crc32cTable[(crc ^ std::to_integer<std::uint32_t>(data[i])) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(SERIALIZER_CRC32C_SSE42)
+// compiled for SSE 4.2 regardless of the target flags, only called if the cpu has it
+__attribute__((target("sse4.2")))
+inline std::uint32_t crc32cSse42(std::uint32_t crc, std::byte const* data, std::size_t size) {
+#if defined(__x86_64__)
+	std::uint64_t crc64{crc};
+	for (; size >= 8; size -= 8, data += 8) {
+		std::uint64_t word;
+		std::memcpy(&word, data, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = static_cast<std::uint32_t>(crc64);
+#endif
+	for (; size; --size, ++data) {
+		crc = _mm_crc32_u8(crc, std::to_integer<std::uint8_t>(*data));
+	}
+	return crc;
+}
+
+inline bool hasSse42() {
+	static bool const supported = __builtin_cpu_supports("sse4.2");
+	return supported;
+}
+#endif
+
+#if defined(SERIALIZER_CRC32C_ARM)
+inline std::uint32_t crc32cArm(std::uint32_t crc, std::byte const* data, std::size_t size) {
+	for (; size >= 8; size -= 8, data += 8) {
+		std::uint64_t word;
+		std::memcpy(&word, data, sizeof(word));
+		crc = __crc32cd(crc, word);
+	}
+	for (; size; --size, ++data) {
+		crc = __crc32cb(crc, std::to_integer<std::uint8_t>(*data));
+	}
+	return crc;
+}
+#endif
+
+// CRC-32C of size bytes, with the SSE 4.2 or ARMv8 CRC instructions where available
+inline std::uint32_t crc32c(std::byte const* data, std::size_t size) {
+	std::uint32_t crc{0xffffffff};
+#if defined(SERIALIZER_CRC32C_SSE42)
+	crc = hasSse42() ? crc32cSse42(crc, data, size) : crc32cTableDriven(crc, data, size);
+#elif defined(SERIALIZER_CRC32C_ARM)
+	crc = crc32cArm(crc, data, size);
+#else
+	crc = crc32cTableDriven(crc, data, size);
+#endif
+	return crc ^ 0xffffffff;
+}
+
+// the CRC-32 element of EBML: id 0xBF, size 4 and the checksum in little endian. Elements with checksums
+// hold their children in blocks, each behind a CRC-32 element that covers the block up to the next one.
+// A child that carries checksums itself is a block of its own whose checksum covers only its id and
+// size, so every byte is hashed by one element.
+inline constexpr std::size_t checksumElementSize = 6;
+
+inline void writeChecksumElement(std::vector<std::byte>& out, std::byte const* data, std::size_t size) {
+	auto crc = crc32c(data, size);
+	out.insert(out.end(), {std::byte{0xBF}, std::byte{0x84},
+	                       std::byte(crc), std::byte(crc >> 8), std::byte(crc >> 16), std::byte(crc >> 24)});
+}
+
+// checksum stored in the content of a CRC-32 element
+inline std::uint32_t readChecksum(std::byte const* content) {
+	return std::to_integer<std::uint32_t>(content[0])
+	     | std::to_integer<std::uint32_t>(content[1]) << 8
+	     | std::to_integer<std::uint32_t>(content[2]) << 16
+	     | std::to_integer<std::uint32_t>(content[3]) << 24;
+}
+
+// the content of an element starts with a CRC-32 element, it carries checksums itself
+inline bool startsWithChecksum(std::byte const* content, std::size_t size) {
+	return size >= checksumElementSize and content[0] == std::byte{0xBF} and content[1] == std::byte{0x84};
+}
+
+enum class BlockCheck { Corrupted, Covered, HeaderOnly };
+
+// checks the block [begin, end) against the checksum crc. onlyChild is the content of the single child of
+// the block, nullptr if it has several. A child that carries checksums itself is HeaderOnly, the content of
+// the children of a Covered block needs no further checks.
+inline BlockCheck checkBlock(std::uint32_t crc, std::byte const* begin, std::byte const* end, std::byte const* onlyChild, std::size_t onlyChildSize) {
+	// data that only looks like checksums is covered as a whole
+	if (onlyChild and startsWithChecksum(onlyChild, onlyChildSize) and crc32c(begin, static_cast<std::size_t>(onlyChild - begin)) == crc) {
+		return BlockCheck::HeaderOnly;
+	}
+	return crc32c(begin, static_cast<std::size_t>(end - begin)) == crc ? BlockCheck::Covered : BlockCheck::Corrupted;
+}
+
+}
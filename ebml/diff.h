@@ -0,0 +1,459 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "serializer/Schema.h"
+
+#include "Deserializer.h"
+#include "Serializer.h"
+#include "crc32c.h"
+#include "hasher.h"
+#include "ids.h"
+#include "validate.h"
+#include "varint.h"
+
+namespace serializer::ebml {
+
+namespace detail {
+
+// walks two documents along a schema and writes the elements that turn the first into the second
+class Differ {
+	struct Header {
+		std::size_t autoIdLen{4};
+		bool dictionaries{false};
+		bool checksums{false};
+	};
+
+	Header before;
+	Header after;
+	std::unordered_map<Schema const*, std::vector<std::uint64_t>> objectIds;
+	// the entries of every map schema as object with the fields first and second
+	std::unordered_map<Schema const*, Schema> entrySchemas;
+	std::uint64_t firstId{0};
+
+	[[noreturn]] static void fail(char const* what) {
+		throw std::runtime_error(std::string{"invalid ebml stream! "} + what);
+	}
+
+	// the children of e, the checksums in front of its blocks are left out
+	static std::vector<ElementView> childrenOf(ElementView const& e, bool checksums) {
+		std::vector<ElementView> children;
+		auto b   = e.content;
+		auto end = e.content + e.size;
+		auto checked = checksums and startsWithChecksum(e.content, e.size);
+		ElementView child;
+		while (b != end) {
+			if (not readElement(b, end, child)) {
+				fail("element does not fit into its parent");
+			}
+			if (checked and child.id == ids::crc32) {
+				continue;
+			}
+			children.push_back(child);
+		}
+		return children;
+	}
+
+	static Header readHeader(ElementView const& root) {
+		for (auto const& e : childrenOf(root, false)) {
+			if (e.id != ids::header) {
+				continue;
+			}
+			Header header;
+			for (auto const& h : childrenOf(e, false)) {
+				if (h.id == ids::docType) {
+					continue;
+				}
+				if (h.size > 8) {
+					fail("integer elements have at most 8 bytes");
+				}
+				auto value = readBigEndian(h.content, h.size);
+				if (h.id == ids::maxIdLength) {
+					header.autoIdLen = static_cast<std::size_t>(value);
+				} else if (h.id == ids::stringDictionary or h.id == ids::fieldDictionary) {
+					header.dictionaries = header.dictionaries or value != 0;
+				} else if (h.id == ids::checksums) {
+					header.checksums = value != 0;
+				} else if (h.id == ids::patch and value != 0) {
+					throw std::invalid_argument("cannot diff patches");
+				}
+			}
+			return header;
+		}
+		fail("there is no header");
+	}
+
+	std::vector<std::uint64_t> const& idsOf(Schema const& object) {
+		auto [it, inserted] = objectIds.try_emplace(&object);
+		if (inserted) {
+			for (auto const& field : object.children) {
+				it->second.push_back(genID<Hash>(std::string_view{field.name}, static_cast<int>(after.autoIdLen)).value());
+			}
+		}
+		return it->second;
+	}
+
+	Schema const& entrySchema(Schema const& map) {
+		auto [it, inserted] = entrySchemas.try_emplace(&map);
+		if (inserted) {
+			it->second.children = map.children;
+			it->second.children[0].name = "first";
+			it->second.children[1].name = "second";
+		}
+		return it->second;
+	}
+
+	static bool equal(ElementView const& a, ElementView const& b) {
+		return a.id == b.id and a.size == b.size and (a.size == 0 or std::memcmp(a.content, b.content, a.size) == 0);
+	}
+
+	static void writeElement(Buffer& out, std::uint64_t id, std::byte const* content, std::size_t size) {
+		Varint vid{id};
+		VarLen len{size};
+		out.insert(out.end(), vid.begin(), vid.end());
+		out.insert(out.end(), len.begin(), len.end());
+		out.insert(out.end(), content, content + size);
+	}
+
+	static void writeElement(Buffer& out, ElementView const& e) {
+		writeElement(out, e.id, e.content, e.size);
+	}
+
+	static void writeMarker(Buffer& out) {
+		writeElement(out, ids::patchMarker, nullptr, 0);
+	}
+
+	// the elements of object after that differ from before, fields that vanished are listed by id
+	void diffFields(Schema const& object, std::vector<ElementView> const& b, std::vector<ElementView> const& a, Buffer& out, bool root=false) {
+		auto const& fieldIds = idsOf(object);
+		auto find = [](std::vector<ElementView> const& children, std::uint64_t id) {
+			for (auto const& child : children) {
+				if (child.id == id) {
+					return &child;
+				}
+			}
+			return static_cast<ElementView const*>(nullptr);
+		};
+		// the header and the field name tables are no fields
+		auto skip = [&](std::uint64_t id) {
+			return root and (id == ids::header or id == ids::fieldNames);
+		};
+		for (auto const& field : a) {
+			if (skip(field.id) or find(a, field.id) != &field) {
+				continue;
+			}
+			auto old = find(b, field.id);
+			if (not old) {
+				writeElement(out, field);
+				continue;
+			}
+			std::size_t i{0};
+			while (i < fieldIds.size() and fieldIds[i] != field.id) {
+				++i;
+			}
+			if (i < fieldIds.size()) {
+				diff(object.children[i], *old, field, out);
+			} else if (not equal(*old, field)) {
+				writeElement(out, field);
+			}
+		}
+		Buffer removed;
+		for (auto const& field : b) {
+			if (not skip(field.id) and not find(a, field.id)) {
+				Varint id{field.id};
+				removed.insert(removed.end(), id.begin(), id.end());
+			}
+		}
+		if (not removed.empty()) {
+			writeElement(out, ids::removedFields, removed.data(), removed.size());
+		}
+	}
+
+	// positional elements of sequences and tuples, runs of unchanged ones are written as their count.
+	// false if they are better replaced: when a is empty or holds other elements, which only happens
+	// for columnar sequences.
+	template<typename SchemaAt>
+	bool diffElements(std::vector<ElementView> const& b, std::vector<ElementView> const& a, Buffer& out, SchemaAt&& schemaAt) {
+		if (a.empty()) {
+			return false;
+		}
+		auto isElement = [](ElementView const& e) { return e.id == ids::sequenceElement or e.id == ids::absentElement; };
+		for (auto const* children : {&b, &a}) {
+			for (auto const& e : *children) {
+				if (not isElement(e)) {
+					return false;
+				}
+			}
+		}
+		std::uint64_t unchanged{0};
+		auto flush = [&] {
+			if (unchanged) {
+				Buffer count;
+				writeBigEndian(count, unchanged, getOctetLength(unchanged));
+				writeElement(out, ids::keptElements, count.data(), count.size());
+				unchanged = 0;
+			}
+		};
+		for (std::size_t i{0}; i < a.size(); ++i) {
+			if (i < b.size() and equal(b[i], a[i])) {
+				++unchanged;
+				continue;
+			}
+			auto const* schema = schemaAt(i);
+			auto mark    = out.size();
+			auto pending = unchanged;
+			flush();
+			if (i < b.size() and schema and b[i].id == ids::sequenceElement and a[i].id == ids::sequenceElement) {
+				if (not diff(*schema, b[i], a[i], out)) {
+					// only the bytes of checksums differed
+					out.resize(mark);
+					unchanged = pending + 1;
+				}
+			} else {
+				writeElement(out, a[i]);
+			}
+		}
+		flush();
+		return true;
+	}
+
+	// changed and new entries by their key, removed entries as removedEntry with their key.
+	// false if e holds other elements than entries and an index.
+	bool diffEntries(Schema const& map, std::vector<ElementView> const& b, std::vector<ElementView> const& a, Buffer& out) {
+		struct Entry {
+			std::string_view key; // the bytes of the content of first
+			ElementView element;
+			std::vector<ElementView> children;
+		};
+		// entries that are equal at the same position in both have the same key and value, only the
+		// others are matched by their key
+		auto entriesOf = [&](std::vector<ElementView> const& elems, std::vector<ElementView> const& others, bool checksums, std::vector<Entry>& entries) {
+			for (std::size_t i{0}; i < elems.size(); ++i) {
+				auto const& e = elems[i];
+				if ((i == 0 and e.id == ids::mapIndex) or (i < others.size() and equal(e, others[i]))) {
+					continue;
+				}
+				if (e.id != ids::sequenceElement) {
+					return false;
+				}
+				auto& entry = entries.emplace_back(Entry{{}, e, childrenOf(e, checksums)});
+				auto key = std::find_if(entry.children.begin(), entry.children.end(), [&](auto const& c) { return c.id == firstId; });
+				if (key == entry.children.end()) {
+					return false;
+				}
+				entry.key = std::string_view(reinterpret_cast<char const*>(key->content), key->size);
+			}
+			return true;
+		};
+		std::vector<Entry> oldEntries;
+		std::vector<Entry> newEntries;
+		if (not entriesOf(b, a, before.checksums, oldEntries) or not entriesOf(a, b, after.checksums, newEntries)) {
+			return false;
+		}
+		std::unordered_map<std::string_view, Entry const*> oldKeys;
+		for (auto const& entry : oldEntries) {
+			oldKeys.try_emplace(entry.key, &entry);
+		}
+		std::unordered_map<std::string_view, Entry const*> newKeys;
+		for (auto const& entry : newEntries) {
+			newKeys.try_emplace(entry.key, &entry);
+		}
+		auto const& schema = entrySchema(map);
+		for (auto const& entry : newEntries) {
+			auto old = oldKeys.find(entry.key);
+			if (old == oldKeys.end()) {
+				writeElement(out, entry.element);
+				continue;
+			}
+			if (equal(old->second->element, entry.element)) {
+				continue;
+			}
+			// the key is always written, it finds the entry
+			Buffer patch;
+			writeMarker(patch);
+			writeElement(patch, firstId, reinterpret_cast<std::byte const*>(entry.key.data()), entry.key.size());
+			auto size = patch.size();
+			diffFields(schema, old->second->children, entry.children, patch);
+			if (patch.size() > size) {
+				writeElement(out, ids::sequenceElement, patch.data(), patch.size());
+			}
+		}
+		for (auto const& entry : oldEntries) {
+			if (not newKeys.count(entry.key)) {
+				Buffer key;
+				writeElement(key, firstId, reinterpret_cast<std::byte const*>(entry.key.data()), entry.key.size());
+				writeElement(out, ids::removedEntry, key.data(), key.size());
+			}
+		}
+		return true;
+	}
+
+public:
+	Differ(ElementView const& _before, ElementView const& _after)
+		: before{readHeader(_before)}, after{readHeader(_after)}
+	{
+		if (before.dictionaries or after.dictionaries) {
+			throw std::invalid_argument("cannot diff documents with a string or field dictionary");
+		}
+		if (before.autoIdLen != after.autoIdLen) {
+			throw std::invalid_argument("cannot diff documents with different id lengths");
+		}
+		firstId = genID<Hash>(std::string_view{"first"}, static_cast<int>(after.autoIdLen)).value();
+	}
+
+	bool checksums() const {
+		return after.checksums;
+	}
+
+	std::size_t autoIdLen() const {
+		return after.autoIdLen;
+	}
+
+	void diffRoot(Schema const& root, ElementView const& b, ElementView const& a, Buffer& out) {
+		diffFields(root, childrenOf(b, false), childrenOf(a, false), out, true);
+	}
+
+	// appends the element with the id of a that turns b into a to out, false if they are equal.
+	// Objects, sequences, tuples and maps are patched where they differ, everything else is replaced.
+	bool diff(Schema const& schema, ElementView const& b, ElementView const& a, Buffer& out) {
+		using Kind = Schema::Kind;
+		if (equal(b, a)) {
+			return false;
+		}
+		Buffer patch;
+		// objects, sequences, tuples and maps mark their content as patch, every element they do not
+		// mention keeps its value
+		auto marked = [&] {
+			writeMarker(patch);
+			return patch.size();
+		};
+		std::size_t base{0};
+		bool patched{false};
+		switch (schema.kind) {
+		case Kind::Optional:
+			return diff(schema.children[0], b, a, out);
+		case Kind::Object:
+			base = marked();
+			diffFields(schema, childrenOf(b, before.checksums), childrenOf(a, after.checksums), patch);
+			patched = true;
+			break;
+		case Kind::Sequence:
+			base = marked();
+			patched = diffElements(childrenOf(b, before.checksums), childrenOf(a, after.checksums), patch,
+			                       [&](std::size_t) { return &schema.children[0]; });
+			break;
+		case Kind::Tuple:
+			base = marked();
+			patched = diffElements(childrenOf(b, before.checksums), childrenOf(a, after.checksums), patch,
+			                       [&](std::size_t i) { return i < schema.children.size() ? &schema.children[i] : nullptr; });
+			break;
+		case Kind::Map:
+			base = marked();
+			patched = diffEntries(schema, childrenOf(b, before.checksums), childrenOf(a, after.checksums), patch);
+			break;
+		case Kind::Variant: {
+			// the index is always written in full, it decides what the value is decoded into
+			auto oldElems = childrenOf(b, before.checksums);
+			auto newElems = childrenOf(a, after.checksums);
+			if (oldElems.size() == 2 and newElems.size() == 2 and equal(oldElems[0], newElems[0])
+			    and oldElems[1].id == ids::sequenceElement and newElems[1].id == ids::sequenceElement
+			    and newElems[0].size <= 8) {
+				auto index = readBigEndian(newElems[0].content, newElems[0].size);
+				if (index < schema.children.size()) {
+					writeElement(patch, newElems[0]);
+					base    = patch.size();
+					patched = true;
+					diff(schema.children[index], oldElems[1], newElems[1], patch);
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		if (not patched) {
+			writeElement(out, a);
+			return true;
+		}
+		// only the bytes of checksums differed
+		if (patch.size() == base) {
+			return false;
+		}
+		writeElement(out, a.id, patch.data(), patch.size());
+		return true;
+	}
+};
+
+}
+
+// Writes a patch that turns the document before into the document after, both written with the
+// same id length and without string or field dictionary. The patch is a document itself that holds
+// only what changed: fields that differ (nested objects only with their changed fields), positional
+// edits of sequences and tuples where runs of unchanged elements are only counted, and changed,
+// new and removed entries of maps. Reading a patch updates the values it is read into in place,
+// every field it does not mention keeps its value:
+//     auto patch = serializer::ebml::diff(sent.data(), sent.size(), current.data(), current.size(), schema);
+//     serializer::ebml::Deserializer deserializer{patch.data(), patch.size()};
+//     deserializer["state"] % state;
+// A sender keeps the last document it sent to diff the next one against it. The target has to hold
+// what before holds, sequences are patched by position, unordered sets therefore only if the target
+// iterates them in the order they were written in before. Like validate() the walk follows root, an
+// object schema whose fields are the fields at the root level, elements it does not know are
+// replaced as a whole. Patches pass validate() with the same schema. The header of the patch holds
+// the CRC-32C of before, a reader compares it with the document it holds through
+// Deserializer::getPatchBase(). Throws std::invalid_argument for documents that cannot be compared
+// and std::runtime_error for malformed ones.
+inline Buffer diff(std::byte const* before, std::size_t beforeSize, std::byte const* after, std::size_t afterSize, Schema const& root) {
+	if (root.kind != Schema::Kind::Object) {
+		throw std::invalid_argument("the root schema has to describe the fields at the root level");
+	}
+	detail::ElementView b{0, before, beforeSize};
+	detail::ElementView a{0, after, afterSize};
+	detail::Differ differ{b, a};
+	Options options;
+	options.autoIdLen = differ.autoIdLen();
+	options.checksums = differ.checksums();
+	options.patch     = true;
+	options.patchBase = detail::crc32c(before, beforeSize);
+	auto patch = Serializer{options}.getBuffer();
+	differ.diffRoot(root, b, a, patch);
+	return patch;
+}
+
+// the patch that turns the value before into after, written as the single root level field name
+template<typename T>
+Buffer diff(T& before, T& after, std::string_view name) {
+	Schema root;
+	auto& field = root.children.emplace_back(makeSchema<T>());
+	field.name = name;
+	Serializer b;
+	b[name] % before;
+	Serializer a;
+	a[name] % after;
+	return diff(b.getBuffer().data(), b.getBuffer().size(), a.getBuffer().data(), a.getBuffer().size(), root);
+}
+
+// updates target with a patch written by diff() of two values, target is the root level field name.
+// Throws std::invalid_argument if target does not serialize to the document the patch was written against.
+template<typename T>
+void applyPatch(std::byte const* patch, std::size_t size, T& target, std::string_view name) {
+	Deserializer deserializer{patch, size};
+	if (auto base = deserializer.getPatchBase()) {
+		Serializer current;
+		current[name] % target;
+		if (detail::crc32c(current.getBuffer().data(), current.getBuffer().size()) != *base) {
+			throw std::invalid_argument("the patch was written against another value");
+		}
+	}
+	deserializer[name] % target;
+}
+
+}
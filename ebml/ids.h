@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+namespace serializer::ebml::ids
+{
+
+// root level
+inline constexpr std::uint64_t header           = 0x0A45DFA3;
+inline constexpr std::uint64_t fieldNames       = 0x0291; // children are named by the field id they hold the name of
+inline constexpr std::uint64_t strings          = 0x029d; // children hold the strings of the string dictionary in the order of their index
+
+// children of the header
+inline constexpr std::uint64_t version          = 0x0286;
+inline constexpr std::uint64_t readVersion      = 0x02f7;
+inline constexpr std::uint64_t maxIdLength      = 0x02f2;
+inline constexpr std::uint64_t maxSizeLength    = 0x02f3;
+inline constexpr std::uint64_t docType          = 0x0282;
+inline constexpr std::uint64_t stringDictionary = 0x0290;
+inline constexpr std::uint64_t fieldDictionary  = 0x0292;
+inline constexpr std::uint64_t checksums        = 0x0293;
+inline constexpr std::uint64_t patch            = 0x0296;
+inline constexpr std::uint64_t patchBase        = 0x029b; // CRC-32C of the document a patch was written against
+
+// elements of a sequence
+inline constexpr std::uint64_t sequenceElement  = 0x01;
+inline constexpr std::uint64_t absentElement    = 0x02; // omitted value that keeps its position
+inline constexpr std::uint64_t mapIndex         = 0x0294; // first element of an indexed map, offsets of its entries in key order
+inline constexpr std::uint64_t rowCount         = 0x0295; // first element of a columnar sequence, the number of records
+inline constexpr std::uint64_t compressed       = 0x029c; // the only child of a compressed element, holds the compressed content
+
+// elements of patches, see diff.h
+inline constexpr std::uint64_t patchMarker      = 0x0297; // first child of an element whose missing children keep their value
+inline constexpr std::uint64_t removedFields    = 0x0298; // ids of missing children that do not keep their value
+inline constexpr std::uint64_t keptElements     = 0x0299; // number of sequence elements that keep their value
+inline constexpr std::uint64_t removedEntry     = 0x029a; // key of a map entry that is removed
+
+// global EBML elements
+inline constexpr std::uint64_t crc32            = 0x3F; // 0xBF, in front of every block of children it covers
+inline constexpr std::uint64_t voidElement      = 0x6C; // 0xEC
+
+// first id the field dictionary hands out
+inline constexpr std::uint64_t firstFieldId     = 0x03;
+
+// ids the field dictionary must not hand out: those above and the all ones values reserved by EBML
+constexpr bool isReserved(std::uint64_t id) {
+	for (std::uint64_t allOnes{0x7f}; allOnes < (std::uint64_t{1} << 56); allOnes = (allOnes << 7) | 0x7f) {
+		if (id == allOnes) {
+			return true;
+		}
+	}
+	return id < firstFieldId or id == crc32 or id == voidElement or id == header or id == fieldNames
+	    or id == version or id == readVersion or id == maxIdLength or id == maxSizeLength or id == docType
+	    or id == stringDictionary or id == fieldDictionary or id == checksums or id == mapIndex
+	    or id == rowCount or id == patch or id == patchMarker or id == removedFields
+	    or id == keptElements or id == removedEntry or id == patchBase or id == compressed
+	    or id == strings;
+}
+
+}
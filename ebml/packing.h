@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "serializer/IntegerEncoding.h"
+
+namespace serializer {
+namespace ebml {
+namespace detail
+{
+
+// little endian base 128, used for the payload of packed sequences
+inline void writeLeb128(std::vector<std::byte>& out, std::uint64_t value) {
+	while (value >= 0x80) {
+		out.emplace_back(std::byte(value | 0x80));
+		value >>= 7;
+	}
+	out.emplace_back(std::byte(value));
+}
+
+inline std::uint64_t readLeb128(std::byte const*& b, std::byte const* end) {
+	std::uint64_t value{0};
+	for (int shift{0}; shift < 64; shift += 7) {
+		if (b == end) {
+			throw std::runtime_error("invalid ebml stream! truncated varint in packed sequence");
+		}
+		auto byte = std::to_integer<std::uint64_t>(*b++);
+		value |= (byte & 0x7f) << shift;
+		if (not (byte & 0x80)) {
+			return value;
+		}
+	}
+	throw std::runtime_error("invalid ebml stream! overlong varint in packed sequence");
+}
+
+constexpr std::size_t leb128Length(std::uint64_t value) {
+	std::size_t len{1};
+	while (value >= 0x80) {
+		value >>= 7;
+		++len;
+	}
+	return len;
+}
+
+constexpr std::uint64_t zigzag(std::uint64_t value) {
+	return (value << 1) ^ static_cast<std::uint64_t>(static_cast<std::int64_t>(value) >> 63);
+}
+
+constexpr std::uint64_t unzigzag(std::uint64_t value) {
+	return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+// the values of a sequence sign extended to 64 bit
+template<typename T>
+constexpr std::uint64_t toBits(T value) {
+	if constexpr (std::is_signed_v<T>) {
+		return static_cast<std::uint64_t>(static_cast<std::int64_t>(value));
+	} else {
+		return static_cast<std::uint64_t>(value);
+	}
+}
+
+// residuals of all varint based encodings, all arithmetic wraps around in 64 bit
+template<typename T>
+void computeResiduals(IntegerEncoding encoding, std::uint64_t const* values, std::size_t count, std::vector<std::uint64_t>& residuals) {
+	residuals.resize(count);
+	if (count == 0) {
+		return;
+	}
+	residuals[0] = std::is_signed_v<T> ? zigzag(values[0]) : values[0];
+	switch (encoding) {
+	case IntegerEncoding::Plain:
+		for (std::size_t i{1}; i < count; ++i) {
+			residuals[i] = std::is_signed_v<T> ? zigzag(values[i]) : values[i];
+		}
+		break;
+	case IntegerEncoding::Delta:
+		for (std::size_t i{1}; i < count; ++i) {
+			residuals[i] = zigzag(values[i] - values[i-1]);
+		}
+		break;
+	case IntegerEncoding::DeltaOfDelta:
+		if (count > 1) {
+			residuals[1] = zigzag(values[1] - values[0]);
+		}
+		for (std::size_t i{2}; i < count; ++i) {
+			residuals[i] = zigzag((values[i] - values[i-1]) - (values[i-1] - values[i-2]));
+		}
+		break;
+	default:
+		throw std::invalid_argument("not a varint based integer encoding");
+	}
+}
+
+template<typename T>
+std::uint64_t minimum(std::uint64_t const* values, std::size_t count) {
+	using Signed = std::conditional_t<std::is_signed_v<T>, std::int64_t, std::uint64_t>;
+	auto min = static_cast<Signed>(values[0]);
+	for (std::size_t i{1}; i < count; ++i) {
+		min = std::min(min, static_cast<Signed>(values[i]));
+	}
+	return static_cast<std::uint64_t>(min);
+}
+
+// longer frame of reference sequences take at least one bit per value, so that the decoded size is bounded
+// by the encoded one
+inline constexpr std::size_t maxZeroWidthCount = 64;
+
+inline unsigned bitWidth(std::uint64_t const* values, std::size_t count, std::uint64_t reference) {
+	std::uint64_t bits{0};
+	for (std::size_t i{0}; i < count; ++i) {
+		bits |= values[i] - reference;
+	}
+	unsigned width{0};
+	while (width < 64 and (bits >> width)) {
+		++width;
+	}
+	if (width == 0 and count > maxZeroWidthCount) {
+		return 1;
+	}
+	// widths that do not fit into one unaligned 64 bit load together with their bit offset are stored unpacked
+	return width > 56 ? 64 : width;
+}
+
+template<typename T>
+std::size_t estimateSize(IntegerEncoding encoding, std::uint64_t const* values, std::size_t count) {
+	if (encoding == IntegerEncoding::FrameOfReference) {
+		auto min = minimum<T>(values, count);
+		return leb128Length(zigzag(min)) + 1 + (bitWidth(values, count, min) * count + 7) / 8;
+	}
+	std::vector<std::uint64_t> residuals;
+	computeResiduals<T>(encoding, values, count, residuals);
+	std::size_t size{0};
+	for (auto r : residuals) {
+		size += leb128Length(r);
+	}
+	return size;
+}
+
+template<typename T>
+IntegerEncoding chooseEncoding(std::uint64_t const* values, std::size_t count) {
+	constexpr std::size_t sampleSize = 256;
+	count = std::min(count, sampleSize);
+	auto best = IntegerEncoding::Plain;
+	if (count == 0) {
+		return best;
+	}
+	auto bestSize = estimateSize<T>(best, values, count);
+	for (auto encoding : {IntegerEncoding::Delta, IntegerEncoding::DeltaOfDelta, IntegerEncoding::FrameOfReference}) {
+		auto size = estimateSize<T>(encoding, values, count);
+		if (size < bestSize) {
+			best     = encoding;
+			bestSize = size;
+		}
+	}
+	return best;
+}
+
+inline void packBits(std::vector<std::byte>& out, std::uint64_t const* values, std::size_t count, std::uint64_t reference, unsigned width) {
+	auto offset = out.size();
+	out.resize(offset + (width * count + 7) / 8);
+	auto data = out.data() + offset;
+	if (width == 64) {
+		for (std::size_t i{0}; i < count; ++i) {
+			for (int b{0}; b < 8; ++b) {
+				data[8*i+b] = std::byte((values[i] - reference) >> (8*b));
+			}
+		}
+		return;
+	}
+	std::size_t bitPos{0};
+	for (std::size_t i{0}; i < count; ++i, bitPos += width) {
+		auto v = values[i] - reference;
+		for (unsigned b{0}; b < width; b += 8) {
+			auto pos = bitPos + b;
+			auto bits = v >> b;
+			data[pos / 8] |= std::byte(bits << (pos % 8));
+			if (pos % 8 and pos / 8 + 1 < out.size() - offset) {
+				data[pos / 8 + 1] |= std::byte(bits >> (8 - pos % 8));
+			}
+		}
+	}
+}
+
+inline std::uint64_t loadLittleEndian(std::byte const* b, std::size_t len) {
+	std::uint64_t word{0};
+	for (std::size_t i{0}; i < len; ++i) {
+		word |= std::to_integer<std::uint64_t>(b[i]) << (8*i);
+	}
+	return word;
+}
+
+inline void unpackBits(std::byte const* data, std::size_t dataLen, std::uint64_t* values, std::size_t count, std::uint64_t reference, unsigned width) {
+	if (width == 0) {
+		std::fill(values, values + count, reference);
+		return;
+	}
+	if (width == 64) {
+		for (std::size_t i{0}; i < count; ++i) {
+			values[i] = loadLittleEndian(data + 8*i, 8) + reference;
+		}
+		return;
+	}
+	auto mask = (std::uint64_t{1} << width) - 1;
+	std::size_t i{0};
+	// all values whose 8 byte window lies inside the data are read with a single load
+	for (; i < count and (i*width)/8 + 8 <= dataLen; ++i) {
+		auto bitPos = i * width;
+		values[i] = ((loadLittleEndian(data + bitPos/8, 8) >> (bitPos % 8)) & mask) + reference;
+	}
+	for (; i < count; ++i) {
+		auto bitPos = i * width;
+		auto len = std::min<std::size_t>(8, dataLen - bitPos/8);
+		values[i] = ((loadLittleEndian(data + bitPos/8, len) >> (bitPos % 8)) & mask) + reference;
+	}
+}
+
+// [encoding][count][payload]
+template<typename T>
+void encodeIntegers(std::vector<std::byte>& out, IntegerEncoding encoding, std::uint64_t const* values, std::size_t count) {
+	if (encoding == IntegerEncoding::Auto) {
+		encoding = chooseEncoding<T>(values, count);
+	}
+	out.emplace_back(std::byte(encoding));
+	writeLeb128(out, count);
+	if (count == 0) {
+		return;
+	}
+	if (encoding == IntegerEncoding::FrameOfReference) {
+		auto min   = minimum<T>(values, count);
+		auto width = bitWidth(values, count, min);
+		writeLeb128(out, zigzag(min));
+		out.emplace_back(std::byte(width));
+		packBits(out, values, count, min, width);
+		return;
+	}
+	std::vector<std::uint64_t> residuals;
+	computeResiduals<T>(encoding, values, count, residuals);
+	for (auto r : residuals) {
+		writeLeb128(out, r);
+	}
+}
+
+template<typename T>
+std::vector<std::uint64_t> decodeIntegers(std::byte const* b, std::byte const* end) {
+	if (b == end) {
+		return {};
+	}
+	auto encoding = IntegerEncoding(std::to_integer<std::uint8_t>(*b++));
+	auto count = readLeb128(b, end);
+	if (count == 0) {
+		return {};
+	}
+	// every varint takes at least one byte
+	if (encoding != IntegerEncoding::FrameOfReference and count > static_cast<std::uint64_t>(end - b)) {
+		throw std::runtime_error("invalid ebml stream! packed sequence is too short");
+	}
+	std::vector<std::uint64_t> values;
+	if (encoding == IntegerEncoding::FrameOfReference) {
+		auto min = unzigzag(readLeb128(b, end));
+		if (b == end) {
+			throw std::runtime_error("invalid ebml stream! packed sequence is too short");
+		}
+		auto width = std::to_integer<unsigned>(*b++);
+		// width * count could overflow
+		auto bits = 8 * static_cast<std::uint64_t>(end - b);
+		if (width > 64 or (width == 0 and count > maxZeroWidthCount) or (width > 0 and count > bits / width)) {
+			throw std::runtime_error("invalid ebml stream! packed sequence is too short");
+		}
+		values.resize(count);
+		unpackBits(b, end - b, values.data(), count, min, width);
+		return values;
+	}
+	values.resize(count);
+	for (auto& v : values) {
+		v = readLeb128(b, end);
+	}
+	switch (encoding) {
+	case IntegerEncoding::Plain:
+		if constexpr (std::is_signed_v<T>) {
+			std::transform(values.begin(), values.end(), values.begin(), unzigzag);
+		}
+		break;
+	case IntegerEncoding::Delta:
+		values[0] = std::is_signed_v<T> ? unzigzag(values[0]) : values[0];
+		std::transform(values.begin()+1, values.end(), values.begin()+1, unzigzag);
+		std::inclusive_scan(values.begin(), values.end(), values.begin());
+		break;
+	case IntegerEncoding::DeltaOfDelta:
+		values[0] = std::is_signed_v<T> ? unzigzag(values[0]) : values[0];
+		std::transform(values.begin()+1, values.end(), values.begin()+1, unzigzag);
+		// the second scan turns the deltas into values, the first value is its own start
+		std::inclusive_scan(values.begin()+1, values.end(), values.begin()+1);
+		std::inclusive_scan(values.begin(), values.end(), values.begin());
+		break;
+	default:
+		throw std::runtime_error("invalid ebml stream! unknown integer encoding");
+	}
+	return values;
+}
+
+}
+}
+}
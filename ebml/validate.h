@@ -0,0 +1,462 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "serializer/Schema.h"
+
+#include "columns.h"
+#include "compression.h"
+#include "crc32c.h"
+#include "hasher.h"
+#include "ids.h"
+#include "varint.h"
+
+namespace serializer::ebml {
+
+namespace detail {
+
+struct ElementView {
+	std::uint64_t id;
+	std::byte const* content;
+	std::size_t size;
+	std::byte const* start{nullptr}; // of the id
+};
+
+// reads the element at b, false if one of its varints is malformed or it does not fit before end
+inline bool readElement(std::byte const*& b, std::byte const* end, ElementView& e) {
+	auto readVarint = [&](std::uint64_t& value) {
+		if (b == end or *b == std::byte{0}) {
+			return false;
+		}
+		auto len = varintLength(*b);
+		if (static_cast<std::size_t>(end - b) < len) {
+			return false;
+		}
+		value = readBigEndian(b, len) & (~std::uint64_t{0} >> (64 - 7*len));
+		b += len;
+		return true;
+	};
+	e.start = b;
+	std::uint64_t size;
+	if (not readVarint(e.id) or not readVarint(size) or size > static_cast<std::uint64_t>(end - b)) {
+		return false;
+	}
+	e.content = b;
+	e.size    = static_cast<std::size_t>(size);
+	b += e.size;
+	return true;
+}
+
+class Validator {
+	std::byte const* begin;
+	std::size_t size;
+	std::size_t autoIdLen{4};
+	bool fieldDictionary{false};
+	bool checksums{false};
+	bool patch{false};
+	// the element being walked is covered by a checksum that was verified already
+	bool verified{false};
+	std::unordered_map<std::string_view, std::uint64_t> fieldIds;
+	// ids of the fields of every object schema, computed on first use
+	std::unordered_map<Schema const*, std::vector<std::uint64_t>> objectIds;
+	std::uint64_t firstId{0};
+	std::uint64_t secondId{0};
+
+	[[noreturn]] void fail(std::byte const* at, char const* what) const {
+		throw std::runtime_error("invalid ebml stream at offset " + std::to_string(at - begin) + "! " + what);
+	}
+
+	// 0 is no valid id, names missing from the field dictionary match nothing
+	std::uint64_t idOf(std::string_view name) const {
+		if (fieldDictionary) {
+			auto it = fieldIds.find(name);
+			return it == fieldIds.end() ? 0 : it->second;
+		}
+		return genID<Hash>(name, static_cast<int>(autoIdLen)).value();
+	}
+
+	std::vector<std::uint64_t> const& idsOf(Schema const& object) {
+		auto [it, inserted] = objectIds.try_emplace(&object);
+		if (inserted) {
+			for (auto const& field : object.children) {
+				it->second.push_back(idOf(field.name));
+			}
+		}
+		return it->second;
+	}
+
+	// calls cb with every child of e, its content has to consist of complete elements.
+	// The blocks behind checksums are verified unless the checksum of an ancestor covered them already.
+	template<typename Cb>
+	void forChildren(ElementView const& e, Cb&& cb) {
+		auto b   = e.content;
+		auto end = e.content + e.size;
+		auto outerVerified = verified;
+		// like in the Deserializer the root level has no checksum
+		auto checked = checksums and e.content != begin and startsWithChecksum(e.content, e.size);
+		ElementView child;
+		while (b != end) {
+			auto at = b;
+			if (not readElement(b, end, child)) {
+				fail(at, "element does not fit into its parent");
+			}
+			if (checked and child.id == ids::crc32) {
+				if (child.size != 4 or child.content != at + 2) {
+					fail(child.content, "crc-32 elements have 4 bytes");
+				}
+				if (not outerVerified) {
+					verified = verifyBlock(child, b, end);
+				}
+				continue;
+			}
+			cb(child);
+		}
+		verified = outerVerified;
+	}
+
+	// verifies the block behind the checksum crc that starts at b and ends with the next checksum,
+	// true if the content of its children is covered
+	bool verifyBlock(ElementView const& crc, std::byte const* b, std::byte const* end) {
+		auto blockEnd = b;
+		std::size_t children{0};
+		ElementView child;
+		ElementView first{};
+		for (auto next = b; next != end;) {
+			if (not readElement(next, end, child)) {
+				fail(blockEnd, "element does not fit into its parent");
+			}
+			if (child.id == ids::crc32) {
+				break;
+			}
+			if (children++ == 0) {
+				first = child;
+			}
+			blockEnd = next;
+		}
+		auto result = checkBlock(readChecksum(crc.content), b, blockEnd, children == 1 ? first.content : nullptr, first.size);
+		if (result == BlockCheck::Corrupted) {
+			fail(crc.content, "checksum mismatch");
+		}
+		return result == BlockCheck::Covered;
+	}
+
+	// like in the Deserializer only elements of patches that start with a marker are patched
+	bool isPatched(ElementView const& e) const {
+		if (not patch) {
+			return false;
+		}
+		auto b   = e.content;
+		auto end = e.content + e.size;
+		ElementView child;
+		if (not readElement(b, end, child) or (checksums and child.id == ids::crc32 and not readElement(b, end, child))) {
+			return false;
+		}
+		return child.id == ids::patchMarker;
+	}
+
+	std::uint64_t readUnsigned(ElementView const& e) const {
+		if (e.size > 8) {
+			fail(e.content, "integer elements have at most 8 bytes");
+		}
+		return readBigEndian(e.content, e.size);
+	}
+
+	void checkFields(Schema const& object, ElementView const& e) {
+		auto const& ids = idsOf(object);
+		forChildren(e, [&](ElementView const& child) {
+			for (std::size_t i{0}; i < ids.size(); ++i) {
+				if (child.id == ids[i]) {
+					check(object.children[i], child);
+					return;
+				}
+			}
+		});
+	}
+
+	// every column is decoded with the type of its field and has to hold a value for each record,
+	// like in the Deserializer records without any column are bounded by the size of the stream
+	void checkColumns(Schema const& record, ElementView const& e) {
+		auto const& ids = idsOf(record);
+		std::uint64_t rows{0};
+		bool hasRows{false};
+		std::vector<std::pair<Schema const*, ElementView>> columns;
+		forChildren(e, [&](ElementView const& child) {
+			if (child.id == ids::rowCount) {
+				if (not std::exchange(hasRows, true)) {
+					rows = readUnsigned(child);
+				}
+				return;
+			}
+			for (std::size_t i{0}; i < ids.size(); ++i) {
+				if (child.id == ids[i]) {
+					columns.emplace_back(&record.children[i], child);
+					return;
+				}
+			}
+		});
+		if (columns.empty() and rows > size) {
+			fail(e.content, "more records than the stream can hold");
+		}
+		using Kind = Schema::Kind;
+		for (auto const& [field, column] : columns) {
+			auto b   = column.content;
+			auto end = column.content + column.size;
+			switch (field->kind) {
+			case Kind::Bool:
+			case Kind::Unsigned:
+				decodeColumn<std::uint64_t>(b, end, rows);
+				break;
+			case Kind::Signed:
+				decodeColumn<std::int64_t>(b, end, rows);
+				break;
+			case Kind::Float:
+				if (field->width == sizeof(float)) {
+					decodeColumn<float>(b, end, rows);
+				} else {
+					decodeColumn<double>(b, end, rows);
+				}
+				break;
+			case Kind::String:
+				decodeColumn<std::string>(b, end, rows);
+				break;
+			default:
+				fail(column.content, "records of columnar sequences only hold scalars and strings");
+			}
+		}
+	}
+
+	void checkIndex(ElementView const& index, std::vector<std::byte const*> const& entries) const {
+		auto width = index.size ? std::to_integer<std::size_t>(index.content[0]) : 0;
+		if (width == 0 or width > 8 or (index.size - 1) % width != 0) {
+			fail(index.content, "malformed map index");
+		}
+		auto base = index.content + index.size;
+		for (auto p = index.content + 1; p != index.content + index.size; p += width) {
+			auto offset = readBigEndian(p, width);
+			if (offset >= static_cast<std::uint64_t>(entries.empty() ? 0 : entries.back() - base + 1)
+			    or not std::binary_search(entries.begin(), entries.end(), base + offset)) {
+				fail(p, "map index points to no entry");
+			}
+		}
+	}
+
+public:
+	Validator(std::byte const* _begin, std::size_t _size) : begin{_begin}, size{_size} {}
+
+	// reads the header and the field name tables at the root level
+	void readHeader(ElementView const& root) {
+		// like the Deserializer only the first header and the first of each of its entries count
+		bool hasHeader{false};
+		forChildren(root, [&](ElementView const& e) {
+			if (e.id == ids::header) {
+				bool first   = not hasHeader;
+				bool idLen   = false;
+				bool fields  = false;
+				bool crc     = false;
+				bool patched = false;
+				hasHeader = true;
+				// everything but the document type is an integer
+				forChildren(e, [&](ElementView const& h) {
+					if (h.id == ids::docType) {
+						return;
+					}
+					auto value = readUnsigned(h);
+					if (not first) {
+						return;
+					}
+					if (h.id == ids::maxIdLength and not std::exchange(idLen, true)) {
+						autoIdLen = value;
+						if (autoIdLen == 0 or autoIdLen > 8) {
+							fail(h.content, "maximum id length out of range");
+						}
+					} else if (h.id == ids::fieldDictionary and not std::exchange(fields, true)) {
+						fieldDictionary = value != 0;
+					} else if (h.id == ids::checksums and not std::exchange(crc, true)) {
+						checksums = value != 0;
+					} else if (h.id == ids::patch and not std::exchange(patched, true)) {
+						patch = value != 0;
+					}
+				});
+			} else if (e.id == ids::fieldNames) {
+				forChildren(e, [&](ElementView const& name) {
+					if (name.id == ids::absentElement) {
+						return;
+					}
+					fieldIds.emplace(std::string_view(reinterpret_cast<char const*>(name.content), name.size), name.id);
+				});
+			}
+		});
+		if (not hasHeader) {
+			fail(root.content, "there is no header");
+		}
+		firstId  = idOf("first");
+		secondId = idOf("second");
+	}
+
+	void check(Schema const& schema, ElementView const& e) {
+		using Kind = Schema::Kind;
+		// elements written compressed are read with and without compressed(), their decoder checks them
+		if (compressedContent(e.content, e.content + e.size)) {
+			return;
+		}
+		switch (schema.kind) {
+		case Kind::Bool:
+		case Kind::Signed:
+		case Kind::Unsigned:
+			readUnsigned(e);
+			return;
+		case Kind::Float:
+			if (e.size != 0 and e.size != 4 and e.size != 8) {
+				fail(e.content, "float elements have 0, 4 or 8 bytes");
+			}
+			return;
+		case Kind::String:
+		case Kind::Packed:
+		case Kind::Compressed:
+			// their decoders check their content themselves
+			return;
+		case Kind::Object:
+			checkFields(schema, e);
+			return;
+		case Kind::Columnar:
+			checkColumns(schema.children[0], e);
+			return;
+		case Kind::Sequence:
+			forChildren(e, [&](ElementView const& elem) {
+				if (elem.id == ids::sequenceElement) {
+					check(schema.children[0], elem);
+				} else if (elem.id == ids::keptElements) {
+					readUnsigned(elem);
+				}
+			});
+			return;
+		case Kind::Map: {
+			// the index of an indexed map has to point at its entries, lookups follow it
+			ElementView index{};
+			std::vector<std::byte const*> entries;
+			bool first{true};
+			forChildren(e, [&](ElementView const& entry) {
+				if (std::exchange(first, false) and entry.id == ids::mapIndex) {
+					index = entry;
+					return;
+				}
+				if (entry.id == ids::removedEntry) {
+					forChildren(entry, [&](ElementView const& part) {
+						if (part.id == firstId) {
+							check(schema.children[0], part);
+						}
+					});
+					return;
+				}
+				if (entry.id != ids::sequenceElement) {
+					return;
+				}
+				entries.push_back(entry.start);
+				forChildren(entry, [&](ElementView const& part) {
+					if (part.id == firstId) {
+						check(schema.children[0], part);
+					} else if (part.id == secondId) {
+						check(schema.children[1], part);
+					}
+				});
+			});
+			if (index.start) {
+				checkIndex(index, entries);
+			}
+			return;
+		}
+		case Kind::Optional:
+			check(schema.children[0], e);
+			return;
+		case Kind::Variant: {
+			std::size_t i{0};
+			std::uint64_t index{0};
+			auto patched = isPatched(e);
+			// positions count like in Deserializer::deserializeElements, absent elements hold theirs
+			forChildren(e, [&](ElementView const& elem) {
+				if (patched and elem.id == ids::keptElements) {
+					i += static_cast<std::size_t>(std::min<std::uint64_t>(readUnsigned(elem), 2));
+					return;
+				}
+				if (elem.id != ids::sequenceElement) {
+					i += elem.id == ids::absentElement;
+					return;
+				}
+				if (i == 0) {
+					index = readUnsigned(elem);
+					if (index >= schema.children.size()) {
+						fail(elem.content, "variant index out of range");
+					}
+				} else if (i == 1) {
+					check(schema.children[index], elem);
+				}
+				++i;
+			});
+			return;
+		}
+		case Kind::Tuple: {
+			std::size_t i{0};
+			auto patched = isPatched(e);
+			forChildren(e, [&](ElementView const& elem) {
+				if (patched and elem.id == ids::keptElements) {
+					// positions behind the members are not checked, the count only has to reach them
+					i += static_cast<std::size_t>(std::min<std::uint64_t>(readUnsigned(elem), schema.children.size()));
+					return;
+				}
+				if (elem.id != ids::sequenceElement) {
+					i += elem.id == ids::absentElement;
+					return;
+				}
+				if (i < schema.children.size()) {
+					check(schema.children[i], elem);
+				}
+				++i;
+			});
+			return;
+		}
+		}
+	}
+};
+
+}
+
+// Verifies a whole document in one pass: every element lies within its parent, every varint is
+// well formed and every scalar has a size its type can be read from. Afterwards the document can be
+// read by an UncheckedDeserializer, which skips these checks:
+//     serializer::ebml::validate(buffer.data(), buffer.size(), serializer::makeSchema<Root>());
+//     serializer::ebml::UncheckedDeserializer deserializer{buffer.data(), buffer.size()};
+// EBML does not tell elements with children from values, so the walk follows root, an object schema
+// whose fields are the fields at the root level. Elements the schema does not know are only checked
+// to fit into their parent, the content of strings, packed and compressed elements is left to their
+// decoders, which check it in both deserializers. The columns of columnar sequences are decoded, each has
+// to hold a value for every record. The checksums of the elements that are walked are verified on the
+// way. Throws std::runtime_error naming the first violation. Damage that keeps the
+// framing intact (flipped bits in a value) is only detected within checksummed elements.
+inline void validate(std::byte const* buffer, std::size_t size, Schema const& root) {
+	if (root.kind != Schema::Kind::Object) {
+		throw std::invalid_argument("the root schema has to describe the fields at the root level");
+	}
+	detail::ElementView document{0, buffer, size};
+	detail::Validator validator{buffer, size};
+	validator.readHeader(document);
+	validator.check(root, document);
+}
+
+// validates a document with the single root level field name of type T
+template<typename T>
+void validate(std::byte const* buffer, std::size_t size, std::string_view name) {
+	Schema root;
+	auto& field = root.children.emplace_back(makeSchema<T>());
+	field.name = name;
+	validate(buffer, size, root);
+}
+
+}
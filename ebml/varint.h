@@ -1,8 +1,21 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <stdlib.h>
+#endif
 
 namespace serializer {
 namespace ebml {
@@ -10,43 +23,91 @@ namespace ebml {
 namespace detail 
 {
 
+// number of leading zero bits, 64 for 0
+inline int countlZero(std::uint64_t value) noexcept {
+#if defined(__cpp_lib_bitops)
+    return std::countl_zero(value);
+#elif defined(__GNUC__)
+    return value ? __builtin_clzll(value) : 64;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    return _BitScanReverse64(&index, value) ? 63 - static_cast<int>(index) : 64;
+#else
+    int n{64};
+    for (; value; value >>= 1) {
+        --n;
+    }
+    return n;
+#endif
+}
+
+// converts between host and big endian byte order, in both directions
+inline std::uint64_t bigEndian(std::uint64_t value) noexcept {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#elif defined(__cpp_lib_byteswap)
+    return std::byteswap(value);
+#elif defined(__GNUC__)
+    return __builtin_bswap64(value);
+#elif defined(_MSC_VER)
+    return _byteswap_uint64(value);
+#else
+    std::uint64_t swapped{0};
+    for (int i{0}; i < 8; ++i) {
+        swapped = (swapped << 8) | ((value >> (8*i)) & 0xff);
+    }
+    return swapped;
+#endif
+}
+
+// number of bytes needed to store val, 0 for 0, signed values keep room for their sign bit
 template<typename T>
-constexpr static std::size_t getOctetLength(T val) {
+std::size_t getOctetLength(T val) {
     if constexpr (std::is_unsigned_v<T>) {
-        int octets{0};
-        while (val) {
-            ++octets;
-            val >>= 8;
-        }
-        return octets;
+        auto bits = 64 - countlZero(static_cast<std::uint64_t>(val));
+        return static_cast<std::size_t>(bits + 7) / 8;
     } else {
         if (val == 0) {
             return 0;
         }
-        if (val > 0) {
-            // the MSBit must not be set for positive numbers
-            T ref = 0x7f;
-            for (int i{1}; i < 9; ++i) {
-                if (val <= ref) {
-                    return i;
-                }
-                ref = (ref << 8) + 0xff;
-            }
-            return 8;
-        } else {
-            val = ~val; 
-            T ref = 0x7f;
-            for (int i{1}; i < 9; ++i) {
-                if (val <= ref) {
-                    return i;
-                }
-                ref = (ref << 8) + 0xff;
-            }
-            return 8;
-        }
+        // negative numbers need as many bytes as their complement
+        auto value = static_cast<std::int64_t>(val);
+        auto magnitude = static_cast<std::uint64_t>(value < 0 ? ~value : value);
+        auto bits = 64 - countlZero(magnitude) + 1;
+        return static_cast<std::size_t>(bits + 7) / 8;
     }
 }
 
+// appends the len (at most 8) lowest bytes of value, most significant first, with one store
+inline void writeBigEndian(std::vector<std::byte>& out, std::uint64_t value, std::size_t len) {
+    if (len == 0) {
+        return;
+    }
+    auto word = bigEndian(value << (8*(8-len)));
+    auto pos = out.size();
+    out.resize(pos + sizeof(word));
+    std::memcpy(out.data() + pos, &word, sizeof(word));
+    out.resize(pos + len);
+}
+
+// reads len (at most 8) bytes, most significant first, without sign extension
+inline std::uint64_t readBigEndian(std::byte const* b, std::size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    std::uint64_t word{0};
+    std::memcpy(&word, b, len);
+    return bigEndian(word) >> (8*(8-len));
+}
+
+}
+
+// selects the decoding constructors of Varint and VarLen that trust their input, see validate()
+struct Unchecked {};
+
+// length of a varint from the leading zero bits of its first byte
+inline std::size_t varintLength(std::byte head) noexcept {
+    return static_cast<std::size_t>(detail::countlZero(std::to_integer<std::uint64_t>(head)) - 55);
 }
 
 struct Varint {
@@ -77,6 +138,13 @@ public:
         buffer[0] |= head;
     }
 
+    Varint(std::byte const* buf, Unchecked) noexcept
+        : len{varintLength(*buf)}
+    {
+        std::copy(buf, buf+len, buffer.begin());
+        val = detail::readBigEndian(buf, len) & (~std::uint64_t{0} >> (64 - 7*len));
+    }
+
     constexpr Varint(std::byte const* buf, std::size_t buf_len) {
         if (buf_len == 0) {
             return;
@@ -174,6 +242,13 @@ public:
         buffer[0] |= head;
     }
 
+    VarLen(std::byte const* buf, Unchecked) noexcept
+        : len{varintLength(*buf)}
+    {
+        std::copy(buf, buf+len, buffer.begin());
+        val = detail::readBigEndian(buf, len) & (~std::uint64_t{0} >> (64 - 7*len));
+    }
+
     constexpr VarLen(std::byte const* buf, std::size_t buf_len) {
         if (buf_len == 0) {
             return;
@@ -0,0 +1,168 @@
+#include "instrumentation.h"
+#include "demangle.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <typeindex>
+
+
+namespace serializer::instrumentation {
+
+namespace {
+
+struct Entry {
+	std::type_info const* type;
+	std::unique_ptr<detail::Counters> counters;
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::map<std::pair<std::type_index, Direction>, Entry> entries;
+};
+
+Registry& registry() {
+	static Registry r;
+	return r;
+}
+
+thread_local std::uint64_t allocations{0};
+
+}
+
+namespace detail {
+
+Counters& counters(std::type_info const& type, Direction direction) {
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	auto& entry = r.entries[{std::type_index{type}, direction}];
+	if (not entry.counters) {
+		entry = {&type, std::make_unique<Counters>()};
+	}
+	return *entry.counters;
+}
+
+std::uint64_t allocationCount() {
+	return allocations;
+}
+
+}
+
+std::vector<TypeStats> collect() {
+	std::vector<TypeStats> stats;
+	{
+		auto& r = registry();
+		std::lock_guard lock{r.mutex};
+		for (auto const& [key, entry] : r.entries) {
+			auto const& c = entry.counters;
+			if (c->calls.load(std::memory_order_relaxed) == 0) {
+				continue;
+			}
+			stats.push_back({demangle(*entry.type), key.second,
+			                 c->calls.load(std::memory_order_relaxed),
+			                 c->bytes.load(std::memory_order_relaxed),
+			                 c->nanoseconds.load(std::memory_order_relaxed),
+			                 c->allocations.load(std::memory_order_relaxed)});
+		}
+	}
+	std::sort(stats.begin(), stats.end(), [](auto const& a, auto const& b) {
+		return a.nanoseconds > b.nanoseconds;
+	});
+	return stats;
+}
+
+void visit(std::function<void(TypeStats const&)> const& cb) {
+	for (auto const& s : collect()) {
+		cb(s);
+	}
+}
+
+void report(std::ostream& out) {
+	out << std::left << std::setw(12) << "direction"
+	    << std::right << std::setw(12) << "calls" << std::setw(14) << "bytes"
+	    << std::setw(14) << "ms" << std::setw(14) << "allocations" << "  type\n";
+	for (auto const& s : collect()) {
+		out << std::left << std::setw(12) << (s.direction == Direction::Serialize ? "serialize" : "deserialize")
+		    << std::right << std::setw(12) << s.calls << std::setw(14) << s.bytes
+		    << std::setw(14) << std::fixed << std::setprecision(3) << static_cast<double>(s.nanoseconds) / 1e6
+		    << std::setw(14) << s.allocations << "  " << s.type << '\n';
+	}
+}
+
+void reset() {
+	auto& r = registry();
+	std::lock_guard lock{r.mutex};
+	for (auto& [key, entry] : r.entries) {
+		entry.counters->calls       = 0;
+		entry.counters->bytes       = 0;
+		entry.counters->nanoseconds = 0;
+		entry.counters->allocations = 0;
+	}
+}
+
+}
+
+#ifdef SERIALIZER_INSTRUMENTATION_ALLOCATIONS
+// counting replacements of the global allocation functions, all memory is released with free()
+
+void* operator new(std::size_t size) {
+	++serializer::instrumentation::allocations;
+	if (auto p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	++serializer::instrumentation::allocations;
+	auto align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+	if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return ::operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+	std::free(p);
+}
+#endif
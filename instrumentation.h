@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// Opt-in per type metrics of all backends. Define SERIALIZER_INSTRUMENTATION and compile
+// instrumentation.cpp to record how often every type is (de)serialized, how many bytes its
+// elements take (EBML only, the tree based backends have no byte sizes) and how much time it takes.
+// Time and bytes are inclusive, a struct accounts for its members as well.
+// With SERIALIZER_INSTRUMENTATION_ALLOCATIONS instrumentation.cpp additionally replaces the global
+// operator new to count the allocations that happen during (de)serialization.
+// Without SERIALIZER_INSTRUMENTATION the hooks compile to nothing.
+
+namespace serializer::instrumentation {
+
+enum class Direction : std::uint8_t {
+	Serialize,
+	Deserialize,
+};
+
+struct TypeStats {
+	std::string   type; // demangled name
+	Direction     direction;
+	std::uint64_t calls;
+	std::uint64_t bytes;
+	std::uint64_t nanoseconds;
+	std::uint64_t allocations;
+};
+
+// metrics of all types recorded so far, most expensive first
+std::vector<TypeStats> collect();
+
+// calls cb with the metrics of every type, most expensive first
+void visit(std::function<void(TypeStats const&)> const& cb);
+
+// writes collect() as a table
+void report(std::ostream& out);
+
+// sets all metrics to zero
+void reset();
+
+namespace detail {
+
+struct Counters {
+	std::atomic<std::uint64_t> calls{0};
+	std::atomic<std::uint64_t> bytes{0};
+	std::atomic<std::uint64_t> nanoseconds{0};
+	std::atomic<std::uint64_t> allocations{0};
+};
+
+// counters of one type, they live as long as the program
+Counters& counters(std::type_info const& type, Direction direction);
+
+// allocations of the current thread, only counted with SERIALIZER_INSTRUMENTATION_ALLOCATIONS
+std::uint64_t allocationCount();
+
+template<typename T, Direction direction>
+Counters& countersOf() {
+	static Counters& c = counters(typeid(T), direction);
+	return c;
+}
+
+// records one call when it goes out of scope, bytes() is asked for the encoded size at that point
+template<typename Bytes>
+class Probe {
+	Counters& counters;
+	Bytes bytes;
+	std::chrono::steady_clock::time_point start;
+	std::uint64_t allocationsAtStart;
+public:
+	Probe(Counters& _counters, Bytes _bytes)
+		: counters{_counters}
+		, bytes{std::move(_bytes)}
+		, start{std::chrono::steady_clock::now()}
+		, allocationsAtStart{allocationCount()}
+	{}
+
+	Probe(Probe const&) = delete;
+	Probe& operator=(Probe const&) = delete;
+
+	~Probe() {
+		auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		counters.calls.fetch_add(1, std::memory_order_relaxed);
+		counters.bytes.fetch_add(static_cast<std::uint64_t>(bytes()), std::memory_order_relaxed);
+		counters.nanoseconds.fetch_add(static_cast<std::uint64_t>(duration.count()), std::memory_order_relaxed);
+		counters.allocations.fetch_add(allocationCount() - allocationsAtStart, std::memory_order_relaxed);
+	}
+};
+
+}
+}
+
+// placed at the top of a backend's operator%, bytes is a callable returning the encoded size
+#ifdef SERIALIZER_INSTRUMENTATION
+#define SERIALIZER_INSTRUMENT(Type, direction, bytes)                                                      \
+	::serializer::instrumentation::detail::Probe serializerProbe {                                         \
+		::serializer::instrumentation::detail::countersOf<Type, ::serializer::instrumentation::direction>(), \
+		bytes                                                                                               \
+	}
+#else
+#define SERIALIZER_INSTRUMENT(Type, direction, bytes)
+#endif
@@ -2,10 +2,13 @@
 
 #include <json/json.h>
 
+#include <memory>
 #include <type_traits>
 #include <string_view>
 
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
 namespace serializer {
@@ -13,69 +16,128 @@ namespace json {
 
 struct Deserializer : traits::SerializerTraits<true> {
 private:
-	Json::Value node;
+	// the tree is copied once by the root, child deserializers only point into it
+	struct Document {
+		Json::Value root;
+		Context context;
+		serializer::detail::UpdateMode updateMode;
+	};
+	std::shared_ptr<Document> document;
+	Json::Value const* node;
+
+	Deserializer(std::shared_ptr<Document> _document, Json::Value const* _node)
+		: document{std::move(_document)}, node{_node} {}
 public:
-	Deserializer(Json::Value const& _node) : node(_node) {}
+	Deserializer(Json::Value const& _node)
+		: document{std::make_shared<Document>(Document{_node, {}, {}})}, node{&document->root} {}
 
 	Deserializer operator[](std::string const& name) {
-		return node[name];
+		return {document, &(*node)[name]};
 	}
 
 	Json::Value const& getNode() const {
-		return node;
+		return *node;
+	}
+
+	Context& getContext() {
+		return document->context;
+	}
+
+	serializer::detail::UpdateMode& getUpdateMode() {
+		return document->updateMode;
+	}
+
+	// false if the value is missing or null
+	bool present() const {
+		return not node->isNull();
 	}
 
 	template<typename T>
-	void operator%(T& t) {
-		if constexpr (traits::has_serialize_function_v<T, decltype(*this)>) {
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		SERIALIZER_INSTRUMENT(value_type, Direction::Deserialize, [] { return 0; });
+
+		if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
 			t.serialize(*this);
-		} else if constexpr (std::is_same_v<T, std::string>) {
-			t = node.asString();
-		} else if constexpr (std::is_same_v<T, bool>) {
-			t = node.asBool();
-		} else if constexpr (std::is_integral_v<T>) {
-			if constexpr (std::is_unsigned_v<T>) {
-				t = node.asLargestUInt();
+		} else if constexpr (std::is_same_v<value_type, std::string>) {
+			char const* begin{};
+			char const* end{};
+			// assigning keeps the capacity of t
+			if (node->getString(&begin, &end)) {
+				t.assign(begin, end);
 			} else {
-				t = node.asLargestInt();
+				t = node->asString();
 			}
-		} else if constexpr (std::is_floating_point_v<T>) {
-			t = node.asDouble();
-		} else if constexpr (std::is_enum_v<T>) {
-			std::underlying_type_t<T> ut{};
-			(*this) % ut;
-			t = static_cast<T>(ut);
-		} else if constexpr (traits::is_map_w_key_v<std::string, T>) {
-			t.clear();
-			for (auto it = node.begin(); it != node.end(); ++it) {
-				Deserializer val_deser{*it};
-				typename T::mapped_type mt;
-				val_deser % mt;
-				t.emplace(it.name(), std::move(mt));
+		} else if constexpr (std::is_same_v<value_type, bool>) {
+			t = node->asBool();
+		} else if constexpr (std::is_integral_v<value_type>) {
+			if constexpr (std::is_unsigned_v<value_type>) {
+				t = node->asLargestUInt();
+			} else {
+				t = node->asLargestInt();
 			}
+		} else if constexpr (std::is_floating_point_v<value_type>) {
+			t = node->asDouble();
+		} else if constexpr (std::is_enum_v<value_type>) {
+			std::underlying_type_t<value_type> ut{};
+			(*this) % ut;
+			t = static_cast<value_type>(ut);
 		} else {
 			// last resort is using a converter
-			Converter<T> converter;
+			Converter<value_type> converter;
 			converter.deserialize(*this, t);
 		}
 	}
 
+	// calls cb with a Deserializer of every sequence element in order, the converter decodes
+	// each element directly into its final place
+	template<typename ElemCb, typename CountCB=int>
+	void deserializeElements(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		if constexpr (std::is_invocable_v<CountCB, std::size_t>) {
+			countCB(node->size());
+		}
+		for (auto const& c : *node) {
+			Deserializer deser{document, &c};
+			cb(deser);
+		}
+	}
+
+	// calls cb with a Deserializer of the key and of the value of every map entry,
+	// objects are maps with string keys, arrays hold {"first": key, "second": value} objects
+	template<typename EntryCb, typename CountCB=int>
+	void deserializeEntries(EntryCb&& cb, CountCB&& countCB=CountCB{}) {
+		if constexpr (std::is_invocable_v<CountCB, std::size_t>) {
+			countCB(node->size());
+		}
+		if (node->isObject()) {
+			for (auto it = node->begin(); it != node->end(); ++it) {
+				char const* end{};
+				auto begin = it.memberName(&end);
+				// member names are stored zero terminated, only names with embedded zeros have to be copied
+				auto key = std::char_traits<char>::length(begin) == static_cast<std::size_t>(end - begin)
+				         ? Json::Value{Json::StaticString{begin}}
+				         : Json::Value{begin, end};
+				Deserializer keyDeser{document, &key}, valueDeser{document, &*it};
+				cb(keyDeser, valueDeser);
+			}
+			return;
+		}
+		for (auto const& entry : *node) {
+			Deserializer keyDeser{document, &entry["first"]}, valueDeser{document, &entry["second"]};
+			cb(keyDeser, valueDeser);
+		}
+	}
+
 	template<typename T, typename ElemCb, typename CountCB=int>
 	void deserializeSequence(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
 		static_assert(std::is_default_constructible_v<T>);
-		if constexpr (std::is_invocable<CountCB, T>::value) {
-			countCB(node.size());
-		}
-		for (auto c : node) {
+		deserializeElements([&](Deserializer& elem) {
 			std::remove_cv_t<T> t;
-			Deserializer deser{c};
-			deser % t;
+			elem % t;
 			cb(std::move(t));
-		}
+		}, std::forward<CountCB>(countCB));
 	}
 };
 
 }
 }
-
-
@@ -2,10 +2,13 @@
 
 #include <json/json.h>
 
+#include <memory>
 #include <type_traits>
 #include <string_view>
 
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
 namespace serializer {
@@ -13,36 +16,53 @@ namespace json {
 
 struct Serializer : traits::SerializerTraits<false> {
 private:
-	Json::Value node;
+	// Json::Value has value semantics, child serializers write into the tree owned by the root
+	struct Document {
+		Json::Value root;
+		Context context;
+	};
+	std::shared_ptr<Document> document;
+	Json::Value* node;
+
+	Serializer(std::shared_ptr<Document> _document, Json::Value* _node)
+		: document{std::move(_document)}, node{_node} {}
 public:
-	Serializer(Json::Value const& _node = {}) : node(_node) {}
+	// members of objects are read back sorted by name, maps with string keys are written in that order
+	static constexpr bool sortedMembers = true;
+
+	Serializer(Json::Value const& _node = {})
+		: document{std::make_shared<Document>(Document{_node, {}})}, node{&document->root} {}
 
 	Serializer operator[](std::string const& name) {
-		return Serializer{node[name]};
+		return Serializer{document, &(*node)[name]};
 	}
 
 	Json::Value const& getNode() const {
-		return node;
+		return *node;
+	}
+
+	Context& getContext() {
+		return document->context;
+	}
+
+	// omitted values are null
+	void omit() {
+		*node = Json::Value{};
 	}
 
 	template<typename T>
 	void operator%(T&& t) {
 		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		SERIALIZER_INSTRUMENT(value_type, Direction::Serialize, [] { return 0; });
 
 		if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
 			t.serialize(*this);
 		} else if constexpr (std::is_same_v<value_type, std::string>) {
-			node = t;
+			*node = t;
 		} else if constexpr (std::is_arithmetic_v<value_type>) {
-			node = t;
+			*node = t;
 		} else if constexpr (std::is_enum_v<value_type>) {
-			node = static_cast<std::underlying_type_t<value_type>>(t);
-		} else if constexpr (traits::is_map_w_key_v<std::string, value_type>) {
-			for (auto& [k, v] : t) {
-				Serializer val_ser;
-				val_ser % v;
-				node[k] = std::move(val_ser.getNode());
-			}
+			*node = static_cast<std::underlying_type_t<value_type>>(t);
 		} else {
 			// last resort is using a converter
 			Converter<value_type> converter;
@@ -50,17 +70,51 @@ public:
 		}
 	}
 
+	// an empty sequence or map is an empty array or object, a null node would read back as absent
+	void beginSequence() {
+		*node = Json::Value{Json::arrayValue};
+	}
+	void beginMap(bool stringKeys) {
+		*node = Json::Value{stringKeys ? Json::objectValue : Json::arrayValue};
+	}
+
 	template<typename IterT>
 	void serializeSequence(IterT begin, IterT end) {
+		beginSequence();
 		for (; begin != end; std::advance(begin, 1)) {
-			Serializer serializer;
-			serializer % *begin;
-			node.append(serializer.getNode());
+			Serializer{document, &node->append(Json::Value{})} % *begin;
 		}
 	}
+
+	// appends one positional element, cb writes it through the Serializer it is called with
+	template<typename ElemCb>
+	void serializeElement(ElemCb&& cb) {
+		Serializer elem{document, &node->append(Json::Value{})};
+		cb(elem);
+	}
+
+	// adds one entry of a map, string keys make the map an object,
+	// with other keys it is an array of {"first": key, "second": value} objects
+	template<typename KeyCb, typename ValueCb>
+	void serializeEntry(KeyCb&& keyCb, ValueCb&& valueCb) {
+		Json::Value key;
+		Serializer keySer{document, &key};
+		keyCb(keySer);
+		if (key.isString()) {
+			// keys that are written as strings without being std::string
+			if (node->isArray() and node->empty()) {
+				*node = Json::Value{Json::objectValue};
+			}
+			Serializer valueSer{document, &(*node)[key.asString()]};
+			valueCb(valueSer);
+			return;
+		}
+		auto& entry = node->append(Json::Value{});
+		entry["first"] = std::move(key);
+		Serializer valueSer{document, &entry["second"]};
+		valueCb(valueSer);
+	}
 };
 
 }
 }
-
-
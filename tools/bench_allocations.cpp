@@ -0,0 +1,135 @@
+// Counts the allocations and measures the time of deserializing containers with every backend. Containers are
+// sized from the element count of the document before their elements are decoded, so a sequence costs one
+// allocation for its storage instead of one per growth step.
+//
+//     bench_allocations [elements] [rounds]
+//
+// Build: g++ -std=c++20 -O2 -DSERIALIZER_INSTRUMENTATION_ALLOCATIONS -I<directory that contains serializer/>
+//        -I/usr/include/jsoncpp tools/bench_allocations.cpp instrumentation.cpp demangle.cpp -ljsoncpp -lyaml-cpp
+//        -o bench_allocations
+
+#ifndef SERIALIZER_INSTRUMENTATION_ALLOCATIONS
+#error "allocations are only counted with SERIALIZER_INSTRUMENTATION_ALLOCATIONS"
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "serializer/ebml/Deserializer.h"
+#include "serializer/ebml/Serializer.h"
+#include "serializer/instrumentation.h"
+#include "serializer/json/Deserializer.h"
+#include "serializer/json/Serializer.h"
+#include "serializer/yaml/Deserializer.h"
+#include "serializer/yaml/Serializer.h"
+
+namespace {
+
+using serializer::instrumentation::detail::allocationCount;
+
+struct EbmlBackend {
+	static constexpr char const* name = "ebml";
+	template<typename T>
+	static auto write(T& value) {
+		serializer::ebml::Serializer s;
+		s["value"] % value;
+		return s.getBuffer();
+	}
+	template<typename T>
+	static void read(serializer::ebml::Buffer const& buffer, T& value) {
+		serializer::ebml::Deserializer d(buffer.data(), buffer.size());
+		d["value"] % value;
+	}
+};
+
+struct JsonBackend {
+	static constexpr char const* name = "json";
+	template<typename T>
+	static auto write(T& value) {
+		serializer::json::Serializer s;
+		s["value"] % value;
+		return s.getNode();
+	}
+	template<typename T>
+	static void read(Json::Value const& node, T& value) {
+		serializer::json::Deserializer d(node);
+		d["value"] % value;
+	}
+};
+
+struct YamlBackend {
+	static constexpr char const* name = "yaml";
+	template<typename T>
+	static auto write(T& value) {
+		serializer::yaml::Serializer s;
+		s["value"] % value;
+		return YAML::Clone(s.getNode());
+	}
+	template<typename T>
+	static void read(YAML::Node const& node, T& value) {
+		serializer::yaml::Deserializer d(node);
+		d["value"] % value;
+	}
+};
+
+// allocations and microseconds of one decode into a new container, the document is built once
+template<typename Backend, typename T>
+void measure(char const* type, T value, int rounds) {
+	auto document = Backend::write(value);
+	std::uint64_t allocations{0};
+	auto start = std::chrono::steady_clock::now();
+	for (int i{0}; i < rounds; ++i) {
+		T decoded;
+		auto before = allocationCount();
+		Backend::read(document, decoded);
+		allocations += allocationCount() - before;
+		if (decoded.size() != value.size()) {
+			std::cerr << "decoded " << decoded.size() << " of " << value.size() << " elements\n";
+			std::exit(1);
+		}
+	}
+	auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	std::cout << std::left << std::setw(6) << Backend::name << std::setw(34) << type
+	          << std::right << std::setw(12) << allocations / static_cast<std::uint64_t>(rounds)
+	          << std::setw(14) << std::fixed << std::setprecision(1) << us / rounds << '\n';
+}
+
+template<typename Backend>
+void measureAll(std::size_t elements, int rounds) {
+	std::vector<std::uint32_t> integers;
+	std::vector<std::string> strings;
+	std::unordered_map<std::string, std::uint32_t> map;
+	std::unordered_set<std::uint64_t> set;
+	for (std::size_t i{0}; i < elements; ++i) {
+		// short enough for the small string buffer, the strings themselves do not allocate
+		auto key = "k" + std::to_string(i);
+		integers.push_back(static_cast<std::uint32_t>(i * 2654435761U));
+		strings.push_back(key);
+		map.emplace(key, static_cast<std::uint32_t>(i));
+		set.insert(i * 0x9e3779b97f4a7c15ULL);
+	}
+	measure<Backend>("vector<uint32_t>", integers, rounds);
+	measure<Backend>("vector<string>", strings, rounds);
+	measure<Backend>("unordered_map<string, uint32_t>", map, rounds);
+	measure<Backend>("unordered_set<uint64_t>", set, rounds);
+}
+
+}
+
+int main(int argc, char** argv) {
+	auto elements = argc > 1 ? static_cast<std::size_t>(std::stoul(argv[1])) : std::size_t{10000};
+	auto rounds   = argc > 2 ? std::stoi(argv[2]) : 20;
+	std::cout << std::left << std::setw(6) << "" << std::setw(34) << "container"
+	          << std::right << std::setw(12) << "allocations" << std::setw(14) << "us" << '\n';
+	measureAll<EbmlBackend>(elements, rounds);
+	measureAll<JsonBackend>(elements, rounds);
+	measureAll<YamlBackend>(elements, rounds);
+}
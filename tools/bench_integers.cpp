@@ -0,0 +1,176 @@
+// Measures the encoding of EBML integer payloads. The length and the bytes of each value are computed by the functions
+// of varint.h and by the byte loops they replaced, which are kept here as reference; both must produce the same
+// bytes. The last lines time the whole element path, a sequence of integers through the Serializer and the
+// Deserializer.
+//
+//     bench_integers [values] [rounds]
+//
+// Build: g++ -std=c++20 -O2 -I<directory that contains serializer/> tools/bench_integers.cpp demangle.cpp
+//        -o bench_integers
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "serializer/ebml/Deserializer.h"
+#include "serializer/ebml/Serializer.h"
+#include "serializer/ebml/varint.h"
+
+namespace {
+
+using Buffer = std::vector<std::byte>;
+
+// the smallest number of bytes that hold val with its sign, 0 for 0, one comparison per byte
+std::size_t referenceOctetLength(std::int64_t val) {
+	if (val == 0) {
+		return 0;
+	}
+	if (val < 0) {
+		val = ~val;
+	}
+	std::int64_t ref = 0x7f;
+	for (std::size_t i{1}; i < 9; ++i) {
+		if (val <= ref) {
+			return i;
+		}
+		ref = (ref << 8) + 0xff;
+	}
+	return 8;
+}
+
+void referenceWrite(Buffer& out, std::int64_t value, std::size_t len) {
+	while (len) {
+		--len;
+		out.emplace_back(std::byte((value >> (8*len)) & 0xff));
+	}
+}
+
+std::int64_t referenceRead(std::byte const* b, std::size_t len) {
+	std::int64_t t{0};
+	for (std::size_t i{0}; i < len; ++i) {
+		t = (t << 8) | static_cast<std::int64_t>(b[i]);
+	}
+	if (len and len < 8 and (b[0] & std::byte{0x80}) != std::byte{0}) {
+		t |= static_cast<std::int64_t>(~std::uint64_t{0} << (8*len));
+	}
+	return t;
+}
+
+std::int64_t libraryRead(std::byte const* b, std::size_t len) {
+	auto bits = serializer::ebml::detail::readBigEndian(b, len);
+	if (len and len < 8) {
+		auto shift = 64 - 8*len;
+		bits = static_cast<std::uint64_t>(static_cast<std::int64_t>(bits << shift) >> shift);
+	}
+	return static_cast<std::int64_t>(bits);
+}
+
+template<typename F>
+double nsPerValue(std::size_t values, int rounds, F&& f) {
+	auto start = std::chrono::steady_clock::now();
+	for (int i{0}; i < rounds; ++i) {
+		f();
+	}
+	auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return ns / (static_cast<double>(values) * rounds);
+}
+
+void report(char const* what, double reference, double library) {
+	std::cout << std::left << std::setw(10) << what << std::right << std::fixed << std::setprecision(1)
+	          << std::setw(12) << reference << std::setw(12) << library << '\n';
+}
+
+}
+
+int main(int argc, char** argv) {
+	auto count  = argc > 1 ? static_cast<std::size_t>(std::stoul(argv[1])) : std::size_t{1} << 20;
+	auto rounds = argc > 2 ? std::stoi(argv[2]) : 20;
+
+	// random values of every width, shifting spreads them evenly over the byte lengths
+	std::mt19937_64 random{2};
+	std::vector<std::int64_t> values(count);
+	for (auto& v : values) {
+		v = static_cast<std::int64_t>(random()) >> (random() % 64);
+	}
+
+	Buffer reference;
+	Buffer library;
+	std::vector<std::pair<std::size_t, std::size_t>> positions;
+	for (auto v : values) {
+		auto len = serializer::ebml::detail::getOctetLength(v);
+		if (len != referenceOctetLength(v)) {
+			std::cerr << "length of " << v << " is " << len << " instead of " << referenceOctetLength(v) << '\n';
+			return 1;
+		}
+		positions.emplace_back(library.size(), len);
+		referenceWrite(reference, v, len);
+		serializer::ebml::detail::writeBigEndian(library, static_cast<std::uint64_t>(v), len);
+	}
+	if (reference != library) {
+		std::cerr << "the encodings differ\n";
+		return 1;
+	}
+	for (std::size_t i{0}; i < count; ++i) {
+		auto [offset, len] = positions[i];
+		if (libraryRead(library.data() + offset, len) != values[i]) {
+			std::cerr << "decoded " << libraryRead(library.data() + offset, len) << " instead of " << values[i] << '\n';
+			return 1;
+		}
+	}
+
+	// the sums keep the compiler from dropping the loops
+	std::int64_t sum{0};
+	std::cout << std::left << std::setw(10) << "ns/value" << std::right << std::setw(12) << "reference"
+	          << std::setw(12) << "varint.h" << '\n';
+	report("write",
+		nsPerValue(count, rounds, [&] {
+			reference.clear();
+			for (auto v : values) {
+				referenceWrite(reference, v, referenceOctetLength(v));
+			}
+			sum += static_cast<std::int64_t>(reference.size());
+		}),
+		nsPerValue(count, rounds, [&] {
+			library.clear();
+			for (auto v : values) {
+				serializer::ebml::detail::writeBigEndian(library, static_cast<std::uint64_t>(v), serializer::ebml::detail::getOctetLength(v));
+			}
+			sum += static_cast<std::int64_t>(library.size());
+		}));
+	report("read",
+		nsPerValue(count, rounds, [&] {
+			for (auto [offset, len] : positions) {
+				sum += referenceRead(reference.data() + offset, len);
+			}
+		}),
+		nsPerValue(count, rounds, [&] {
+			for (auto [offset, len] : positions) {
+				sum -= libraryRead(library.data() + offset, len);
+			}
+		}));
+
+	// one element per value
+	auto write = nsPerValue(count, 1, [&] {
+		serializer::ebml::Serializer s;
+		s["values"] % values;
+		library = s.getBuffer();
+	});
+	std::vector<std::int64_t> decoded;
+	auto read = nsPerValue(count, 1, [&] {
+		serializer::ebml::Deserializer d(library.data(), library.size());
+		d["values"] % decoded;
+	});
+	if (decoded != values) {
+		std::cerr << "the sequence does not round trip\n";
+		return 1;
+	}
+	std::cout << "elements: write " << std::fixed << std::setprecision(1) << write << " ns/value, read " << read
+	          << " ns/value (" << sum << ")\n";
+}
@@ -0,0 +1,132 @@
+// Reads one ebml::Document from several threads at once, each through its own cursors, and checks every value read
+// against the value written. Documents with checksums, a field dictionary and compressed elements are read the same
+// way. Meant to be run under a sanitizer:
+//
+//     stress_document [rounds] [threads]
+//
+// Build: g++ -std=c++20 -O1 -g -fsanitize=thread -I<directory that contains serializer/> tools/stress_document.cpp
+//        demangle.cpp -lpthread -o stress_document
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serializer/Compression.h"
+#include "serializer/IndexedMap.h"
+#include "serializer/ebml/Document.h"
+#include "serializer/ebml/Serializer.h"
+
+namespace {
+
+struct Limits {
+	int rate{0};
+	std::string host;
+	std::optional<int> burst;
+
+	template<typename Node>
+	void serialize(Node& node) {
+		node["rate"]  % rate;
+		node["host"]  % host;
+		node["burst"] % burst;
+	}
+	bool operator==(Limits const&) const = default;
+};
+
+struct Section {
+	std::map<std::string, Limits> limits;
+	std::map<int, std::string> byId;
+	Limits fallback;
+
+	template<typename Node>
+	void serialize(Node& node) {
+		node["limits"]   % limits;
+		node["byId"]     % serializer::indexed(byId);
+		node["fallback"] % fallback;
+	}
+	bool operator==(Section const&) const = default;
+};
+
+Section makeSection(int s) {
+	Section section;
+	for (int i{0}; i < 50; ++i) {
+		section.limits["k" + std::to_string(i)] = {i * s, "host" + std::to_string(i % 7), i % 3 ? std::optional<int>{i} : std::nullopt};
+		section.byId[i] = "id" + std::to_string(i * s);
+	}
+	section.fallback = {s, "fallback", std::nullopt};
+	return section;
+}
+
+std::string sectionName(std::size_t s) {
+	return "section" + std::to_string(s);
+}
+
+void fail(char const* what) {
+	std::cerr << what << '\n';
+	std::exit(1);
+}
+
+// every thread reads the sections in another order, with a new cursor per section
+void readAll(serializer::ebml::Document const& document, std::vector<Section> const& sections, std::size_t start) {
+	for (std::size_t i{0}; i < sections.size(); ++i) {
+		auto s = (start + i * 7) % sections.size();
+		auto const& expected = sections[s];
+		auto cursor = document.cursor();
+		auto node = cursor[sectionName(s)];
+		Limits fallback;
+		node["fallback"] % fallback;
+		std::string value;
+		if (fallback != expected.fallback or not node["byId"].lookup(static_cast<int>(s % 50), value)
+		    or value != expected.byId.at(static_cast<int>(s % 50))) {
+			fail("a field of a section differs");
+		}
+		Section section;
+		node % section;
+		Section packed;
+		cursor["packed"] % serializer::compressed(packed);
+		if (section != expected or packed != sections.front()) {
+			fail("a section differs");
+		}
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+	auto rounds  = argc > 1 ? std::stoi(argv[1]) : 10;
+	auto threads = argc > 2 ? static_cast<std::size_t>(std::stoul(argv[2])) : std::size_t{4};
+	std::vector<Section> sections;
+	for (int s{0}; s < 40; ++s) {
+		sections.push_back(makeSection(s));
+	}
+	for (int mode{0}; mode < 4; ++mode) {
+		serializer::ebml::Options options;
+		options.checksums       = mode & 1;
+		options.checksumMinSize = 256;
+		options.fieldDictionary = mode & 2;
+		serializer::ebml::Serializer out{options};
+		for (std::size_t s{0}; s < sections.size(); ++s) {
+			out[sectionName(s)] % sections[s];
+		}
+		out["packed"] % serializer::compressed(sections.front());
+		auto const& buffer = out.getBuffer();
+
+		for (int round{0}; round < rounds; ++round) {
+			// a new document per round, the first reads of every element race each other
+			serializer::ebml::Document document{buffer.data(), buffer.size()};
+			std::vector<std::thread> readers;
+			for (std::size_t t{0}; t < threads; ++t) {
+				readers.emplace_back([&, t] { readAll(document, sections, t); });
+			}
+			for (auto& reader : readers) {
+				reader.join();
+			}
+		}
+		std::cout << "checksums " << options.checksums << " field dictionary " << options.fieldDictionary << ": "
+		          << rounds << " rounds of " << threads << " threads\n";
+	}
+}
@@ -0,0 +1,144 @@
+// Streams documents through pipes with ebml::AsyncSerializer and ebml::AsyncDeserializer, with both IoContext
+// backends and several pool threads, and checks that the reader gets back what was written. Every round also
+// destroys a serializer before its last field is written and compares the bytes in the pipe with those of the
+// synchronous Serializer. Meant to be run under a sanitizer:
+//
+//     stress_streams [rounds] [threads]
+//
+// Build: g++ -std=c++20 -O1 -g -fsanitize=thread -I<directory that contains serializer/> tools/stress_streams.cpp
+//        demangle.cpp -lpthread -o stress_streams
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "serializer/Async.h"
+#include "serializer/ebml/Serializer.h"
+#include "serializer/ebml/async.h"
+
+namespace {
+
+using serializer::IoBackend;
+using serializer::IoContext;
+using serializer::Task;
+
+struct Record {
+	int id{0};
+	std::string name;
+	std::vector<int> values;
+
+	template<typename Node>
+	void serialize(Node& node) {
+		node["id"]     % id;
+		node["name"]   % name;
+		node["values"] % values;
+	}
+	bool operator==(Record const&) const = default;
+};
+
+using Part = std::vector<Record>;
+
+std::vector<Part> makeParts() {
+	std::vector<Part> parts(4);
+	for (std::size_t p{0}; p < parts.size(); ++p) {
+		for (int i{0}; i < 1000 * static_cast<int>(p); ++i) {
+			parts[p].push_back({i, "record" + std::to_string(i), {i, static_cast<int>(p)}});
+		}
+	}
+	return parts;
+}
+
+std::string partName(std::size_t p) {
+	return "part" + std::to_string(p);
+}
+
+void fail(char const* what) {
+	std::cerr << what << '\n';
+	std::exit(1);
+}
+
+// without flush the serializer goes away before the last field is written
+Task<void> writeParts(IoContext& context, int fd, std::vector<Part>& parts, std::size_t chunkSize, bool flush) {
+	{
+		serializer::ebml::AsyncSerializer out{context, fd, {}, chunkSize};
+		for (std::size_t p{0}; p < parts.size(); ++p) {
+			co_await out.write(partName(p), parts[p]);
+		}
+		if (flush) {
+			co_await out.flush();
+			::close(fd);
+		}
+	}
+}
+
+Task<bool> readParts(IoContext& context, int fd, std::vector<Part> const& parts, std::size_t chunkSize) {
+	serializer::ebml::AsyncDeserializer in{context, fd, chunkSize};
+	for (std::size_t p{0}; p < parts.size(); ++p) {
+		Part part;
+		if (not co_await in.read(partName(p), part) or part != parts[p]) {
+			co_return false;
+		}
+	}
+	co_return true;
+}
+
+void stress(IoBackend backend, std::size_t threads, int rounds, std::vector<Part>& parts) {
+	IoContext context{threads, backend};
+	for (int round{0}; round < rounds; ++round) {
+		for (std::size_t chunkSize : {std::size_t{7}, std::size_t{4096}, std::size_t{1} << 16}) {
+			int fds[2];
+			if (::pipe(fds) != 0) {
+				fail("cannot create a pipe");
+			}
+			auto writer = context.start(writeParts(context, fds[1], parts, chunkSize, true));
+			auto reader = context.start(readParts(context, fds[0], parts, chunkSize));
+			writer.get();
+			if (not reader.get()) {
+				fail("the streamed parts differ");
+			}
+			::close(fds[0]);
+		}
+
+		// the last part is written after the serializer is gone, the pipe is read here
+		int fds[2];
+		if (::pipe(fds) != 0) {
+			fail("cannot create a pipe");
+		}
+		std::vector<Part> last{parts.back()};
+		context.start(writeParts(context, fds[1], last, 4096, false)).get();
+		serializer::ebml::Serializer lastSync;
+		lastSync[partName(0)] % last[0];
+		serializer::ebml::Buffer received;
+		std::byte chunk[8192];
+		while (received.size() < lastSync.getBuffer().size()) {
+			auto n = ::read(fds[0], chunk, sizeof(chunk));
+			if (n <= 0) {
+				break;
+			}
+			received.insert(received.end(), chunk, chunk + n);
+		}
+		if (received != lastSync.getBuffer()) {
+			fail("the part written without flush differs");
+		}
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+	std::cout << (context.getBackend() == IoBackend::IoUring ? "io_uring" : "poll    ") << " threads " << threads
+	          << ": " << rounds << " rounds\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+	auto rounds  = argc > 1 ? std::stoi(argv[1]) : 10;
+	auto threads = argc > 2 ? static_cast<std::size_t>(std::stoul(argv[2])) : std::size_t{4};
+	auto parts = makeParts();
+	for (auto backend : {IoBackend::Automatic, IoBackend::Poll}) {
+		stress(backend, 1, rounds, parts);
+		stress(backend, threads, rounds, parts);
+	}
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <tuple>
 #include <type_traits>
+#include <variant>
 
 namespace serializer
 {
@@ -32,6 +36,42 @@ struct is_pair<std::pair<Ts...>> : std::true_type {};
 template<typename... Ts>
 inline constexpr bool is_pair_v = is_pair<Ts...>::value;
 
+template <typename T>
+struct is_optional : std::false_type {};
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_optional_v = is_optional<T>::value;
+
+// values with an empty state that they take when their element is missing, optionals and owning pointers
+template <typename T>
+struct is_nullable : is_optional<T> {};
+template <typename T, typename Deleter>
+struct is_nullable<std::unique_ptr<T, Deleter>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_nullable_v = is_nullable<T>::value;
+
+template <typename T>
+struct is_variant : std::false_type {};
+template <typename... Ts>
+struct is_variant<std::variant<Ts...>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_variant_v = is_variant<T>::value;
+
+template <typename T>
+struct is_tuple : std::false_type {};
+template <typename... Ts>
+struct is_tuple<std::tuple<Ts...>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_tuple_v = is_tuple<T>::value;
+
+template <typename T, typename = void>
+struct has_reserve : std::false_type {};
+template <typename T>
+struct has_reserve<T, std::void_t<decltype(std::declval<T&>().reserve(std::size_t{}))>> : std::true_type {};
+template<typename T>
+inline constexpr bool has_reserve_v = has_reserve<T>::value;
+
 template <typename T, typename Arg1>
 struct has_serialize_function {
 private:
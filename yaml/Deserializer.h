@@ -2,10 +2,13 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include <memory>
 #include <type_traits>
 #include <string_view>
 
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
 namespace serializer {
@@ -13,61 +16,101 @@ namespace yaml {
 
 struct Deserializer : traits::SerializerTraits<true>{
 private:
+	// shared by all deserializers of one document
+	struct Document {
+		Context context;
+		serializer::detail::UpdateMode updateMode;
+	};
 	YAML::Node node;
+	std::shared_ptr<Document> document;
+
+	Deserializer(YAML::Node const& _node, std::shared_ptr<Document> _document)
+		: node(_node), document{std::move(_document)} {}
 public:
-	Deserializer(YAML::Node const& _node) : node(_node) {}
+	Deserializer(YAML::Node const& _node)
+		: node(_node), document{std::make_shared<Document>()} {}
 
 	Deserializer operator[](std::string const& name) {
-		return node[name];
+		return {node[name], document};
 	}
 
 	YAML::Node const& getNode() const {
 		return node;
 	}
 
+	Context& getContext() {
+		return document->context;
+	}
+
+	serializer::detail::UpdateMode& getUpdateMode() {
+		return document->updateMode;
+	}
+
+	// false if the node is missing or null
+	bool present() const {
+		return node.IsDefined() and not node.IsNull();
+	}
+
 	template<typename T>
-	void operator%(T& t) {
-		if constexpr (traits::has_serialize_function_v<T, decltype(*this)>) {
+	void operator%(T&& t) {
+		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		SERIALIZER_INSTRUMENT(value_type, Direction::Deserialize, [] { return 0; });
+
+		if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
 			t.serialize(*this);
-		} else if constexpr (std::is_same_v<T, std::string>) {
-			t = node.as<std::string>();
-		} else if constexpr (std::is_arithmetic_v<T>) {
-			t = node.as<T>();
-		} else if constexpr (std::is_enum_v<T>) {
-			t = static_cast<T>(node.as<std::underlying_type_t<T>>());
-		} else if constexpr (traits::is_map_v<T>) {
-			t.clear();
-			for (auto const& v : node) {
-				Deserializer left{v.first}, right{v.second};
-				typename T::key_type kt;
-				typename T::mapped_type mt;
-				left % kt;
-				right % mt;
-				t.emplace(std::move(kt), std::move(mt));
+		} else if constexpr (std::is_same_v<value_type, std::string>) {
+			// assigning keeps the capacity of t
+			if (node.IsScalar()) {
+				t.assign(node.Scalar());
+			} else {
+				t = node.as<std::string>();
 			}
+		} else if constexpr (std::is_arithmetic_v<value_type>) {
+			t = node.as<value_type>();
+		} else if constexpr (std::is_enum_v<value_type>) {
+			t = static_cast<value_type>(node.as<std::underlying_type_t<value_type>>());
 		} else {
 			// last resort is using a converter
-			Converter<T> converter;
+			Converter<value_type> converter;
 			converter.deserialize(*this, t);
 		}
 	}
 
+	// calls cb with a Deserializer of every sequence element in order, the converter decodes
+	// each element directly into its final place
+	template<typename ElemCb, typename CountCB=int>
+	void deserializeElements(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
+		if constexpr (std::is_invocable_v<CountCB, std::size_t>) {
+			countCB(node.size());
+		}
+		for (auto const& c : node) {
+			Deserializer deser{c, document};
+			cb(deser);
+		}
+	}
+
+	// calls cb with a Deserializer of the key and of the value of every map entry
+	template<typename EntryCb, typename CountCB=int>
+	void deserializeEntries(EntryCb&& cb, CountCB&& countCB=CountCB{}) {
+		if constexpr (std::is_invocable_v<CountCB, std::size_t>) {
+			countCB(node.size());
+		}
+		for (auto const& entry : node) {
+			Deserializer key{entry.first, document}, value{entry.second, document};
+			cb(key, value);
+		}
+	}
+
 	template<typename T, typename ElemCb, typename CountCB=int>
 	void deserializeSequence(ElemCb&& cb, CountCB&& countCB=CountCB{}) {
 		static_assert(std::is_default_constructible_v<T>);
-		if constexpr (std::is_invocable<CountCB, T>::value) {
-			countCB(node.size());
-		}
-		for (auto c : node) {
+		deserializeElements([&](Deserializer& elem) {
 			std::remove_cv_t<T> t;
-			Deserializer deser{c};
-			deser % t;
+			elem % t;
 			cb(std::move(t));
-		}
+		}, std::forward<CountCB>(countCB));
 	}
 };
 
 }
 }
-
-
@@ -2,10 +2,13 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include <memory>
 #include <type_traits>
 #include <string_view>
 
+#include "serializer/Context.h"
 #include "serializer/Converter.h"
+#include "serializer/instrumentation.h"
 #include "serializer/traits.h"
 
 namespace serializer {
@@ -14,20 +17,33 @@ namespace yaml {
 struct Serializer : traits::SerializerTraits<false> {
 private:
 	YAML::Node node;
+	std::shared_ptr<Context> context;
+
+	Serializer(YAML::Node const& _node, std::shared_ptr<Context> _context)
+		: node(_node), context{std::move(_context)} {}
 public:
-	Serializer(YAML::Node const& _node = YAML::Node{}) : node(_node) {}
+	Serializer(YAML::Node const& _node = YAML::Node{})
+		: node(_node), context{std::make_shared<Context>()} {}
 
 	Serializer operator[](std::string const& name) {
-		return Serializer{node[name]};
+		return Serializer{node[name], context};
 	}
 
 	YAML::Node const& getNode() const {
 		return node;
 	}
 
+	Context& getContext() {
+		return *context;
+	}
+
+	// a node that is never assigned does not show up in its map, in a sequence it is null
+	void omit() {}
+
 	template<typename T>
 	void operator%(T&& t) {
 		using value_type = std::remove_cv_t<std::remove_reference_t<T>>;
+		SERIALIZER_INSTRUMENT(value_type, Direction::Serialize, [] { return 0; });
 
 		if constexpr (traits::has_serialize_function_v<value_type, decltype(*this)>) {
 			t.serialize(*this);
@@ -37,13 +53,6 @@ public:
 			node = t;
 		} else if constexpr (std::is_enum_v<value_type>) {
 			node = static_cast<std::underlying_type_t<value_type>>(t);
-		} else if constexpr (traits::is_map_v<value_type>) {
-			for (auto& elem : t) {
-				Serializer left, right;
-				left % elem.first;
-				right% elem.second;
-				node[left.getNode()] = right.getNode();
-			}
 		} else {
 			// last resort is using a converter
 			Converter<value_type> converter;
@@ -51,17 +60,41 @@ public:
 		}
 	}
 
+	// an empty sequence or map is written as [] or {}, an undefined node would read back as absent
+	void beginSequence() {
+		node = YAML::Node{YAML::NodeType::Sequence};
+	}
+	void beginMap(bool) {
+		node = YAML::Node{YAML::NodeType::Map};
+	}
+
 	template<typename IterT>
 	void serializeSequence(IterT begin, IterT end) {
+		beginSequence();
 		for (; begin != end; std::advance(begin, 1)) {
-			Serializer serializer;
+			Serializer serializer{YAML::Node{}, context};
 			serializer % *begin;
 			node.push_back(serializer.getNode());
 		}
 	}
+
+	// appends one positional element, cb writes it through the Serializer it is called with
+	template<typename ElemCb>
+	void serializeElement(ElemCb&& cb) {
+		Serializer elem{YAML::Node{}, context};
+		cb(elem);
+		node.push_back(elem.getNode());
+	}
+
+	// adds one entry of a map, keyCb and valueCb write key and value through the Serializers they are called with
+	template<typename KeyCb, typename ValueCb>
+	void serializeEntry(KeyCb&& keyCb, ValueCb&& valueCb) {
+		Serializer key{YAML::Node{}, context}, value{YAML::Node{}, context};
+		keyCb(key);
+		valueCb(value);
+		node[key.getNode()] = value.getNode();
+	}
 };
 
 }
 }
-
-